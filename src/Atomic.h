@@ -0,0 +1,60 @@
+/**
+ *  Minimal atomic operations on 64 bit counters, for the few places
+ *  where taking a lock for a counter would be silly.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+typedef volatile long long AtomicCounter;
+
+/* add v to *p, returning the new value */
+inline long long
+atomicAdd(AtomicCounter* p, long long v)
+{
+#ifdef WIN32
+    return InterlockedExchangeAdd64(p, v) + v;
+#else
+    return __sync_add_and_fetch(p, v);
+#endif
+}
+
+/* set *p to desired if it currently holds expected */
+inline bool
+atomicCompareAndSwap(AtomicCounter* p, long long expected, long long desired)
+{
+#ifdef WIN32
+    return InterlockedCompareExchange64(p, desired, expected) == expected;
+#else
+    return __sync_bool_compare_and_swap(p, expected, desired);
+#endif
+}
+
+/* read *p, atomically even where 64 bit loads aren't */
+inline long long
+atomicLoad(AtomicCounter* p)
+{
+#ifdef WIN32
+    return InterlockedCompareExchange64(p, 0, 0);
+#else
+    return __sync_fetch_and_add(p, 0);
+#endif
+}
+
+/* set *p to v, with the same ordering as the other operations */
+inline void
+atomicStore(AtomicCounter* p, long long v)
+{
+    long long cur = atomicLoad(p);
+    while (!atomicCompareAndSwap(p, cur, v)) {
+        cur = atomicLoad(p);
+    }
+}
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ *  Content defined chunk boundaries, FastCDC style (Xia et al., 2016).
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "ContentChunker.h"
+#include <string.h>
+
+// at least this much is read at a time when finding boundaries
+#define CC_WINDOW (8 * 1024 * 1024)
+// the largest chunk allowed.  the window is twice the largest chunk,
+// and several chunkings may run at once, so this bounds their memory
+#define CC_MAX_CHUNK (16 * 1024 * 1024)
+
+namespace {
+
+// random values per byte.  generated from a fixed seed: boundaries must
+// never change between releases or nothing would deduplicate.
+struct GearTable {
+    unsigned long long t[256];
+    GearTable() {
+        unsigned long long x = 0x2545f4914f6cdd1dULL;
+        for (int i = 0; i < 256; i++) {
+            // splitmix64
+            x += 0x9e3779b97f4a7c15ULL;
+            unsigned long long z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            t[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+const GearTable s_gear;
+
+int
+log2Floor(size_t v)
+{
+    int n = 0;
+    while (v >>= 1) {
+        n++;
+    }
+    return n;
+}
+
+// the top bits of the gear hash cover the most recent 64 bytes
+unsigned long long
+topBits(int n)
+{
+    if (n <= 0) return 0;
+    if (n >= 64) return ~0ULL;
+    return ~0ULL << (64 - n);
+}
+
+}
+
+ContentChunker::ContentChunker(size_t minSize, size_t avgSize, size_t maxSize) :
+    m_min(minSize), m_avg(avgSize), m_max(maxSize) {
+    int bits = log2Floor(avgSize);
+    // normalization level 2, per the paper
+    m_maskSmall = topBits(bits + 2);
+    m_maskLarge = topBits(bits - 2);
+}
+
+bool
+ContentChunker::validSizes(size_t minSize, size_t avgSize, size_t maxSize)
+{
+    return minSize >= 64 && minSize < avgSize && avgSize < maxSize
+        && maxSize <= CC_MAX_CHUNK;
+}
+
+size_t
+ContentChunker::cut(const unsigned char* p, size_t len) const
+{
+    if (len <= m_min) {
+        return len;
+    }
+    size_t n = len < m_max ? len : m_max;
+    size_t normal = n < m_avg ? n : m_avg;
+    const unsigned long long* g = s_gear.t;
+    unsigned long long h = 0;
+    // nothing before the minimum can be a boundary, but the hash has to
+    // have seen the 64 bytes that lead up to it
+    size_t i = m_min - 64;
+    for (; i < m_min; i++) {
+        h = (h << 1) + g[p[i]];
+    }
+    for (; i < normal; i++) {
+        h = (h << 1) + g[p[i]];
+        if (!(h & m_maskSmall)) {
+            return i + 1;
+        }
+    }
+    for (; i < n; i++) {
+        h = (h << 1) + g[p[i]];
+        if (!(h & m_maskLarge)) {
+            return i + 1;
+        }
+    }
+    return n;
+}
+
+bool
+ContentChunker::boundaries(const NativeFile& file, long long size,
+                           std::vector<std::pair<long long, long long> >& out,
+                           std::string& err) const
+{
+    size_t window = CC_WINDOW;
+    if (window < 2 * m_max) {
+        window = 2 * m_max;
+    }
+    std::vector<unsigned char> buf(window);
+    long long pos = 0;      // file offset of buf[0]
+    size_t have = 0;
+    while (pos + (long long) have < size || have > 0) {
+        // top up the window
+        while (have < window && pos + (long long) have < size) {
+            size_t want = window - have;
+            if ((long long) want > size - pos - (long long) have) {
+                want = (size_t) (size - pos - (long long) have);
+            }
+            long long rd = file.readAt(&buf[have], want, pos + (long long) have);
+            if (rd < 0) {
+                err = "error reading file";
+                return false;
+            }
+            if (rd == 0) {
+                // shrank under us, chunk what we have
+                size = pos + (long long) have;
+                break;
+            }
+            have += (size_t) rd;
+        }
+        bool atEnd = pos + (long long) have >= size;
+        size_t off = 0;
+        while (off < have && (atEnd || have - off >= m_max)) {
+            size_t n = cut(&buf[off], have - off);
+            out.push_back(std::make_pair(pos + (long long) off, (long long) n));
+            off += n;
+        }
+        memmove(&buf[0], &buf[off], have - off);
+        pos += (long long) off;
+        have -= off;
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+/**
+ *  Content defined chunk boundaries, FastCDC style: a gear rolling hash
+ *  with cut point skipping and normalized chunking.  Boundaries depend
+ *  only on nearby bytes, so an edit near the start of a file leaves the
+ *  chunks after it unchanged.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __CONTENTCHUNKER_H__
+#define __CONTENTCHUNKER_H__
+
+#include "FileIO.h"
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+class ContentChunker {
+public:
+    /* chunks are at least minSize and at most maxSize bytes (except a
+     * final short one), averaging about avgSize.  requires
+     * 64 <= minSize < avgSize < maxSize <= 16MB */
+    ContentChunker(size_t minSize, size_t avgSize, size_t maxSize);
+    /* true if the sizes given to the constructor are usable */
+    static bool validSizes(size_t minSize, size_t avgSize, size_t maxSize);
+    /* length of the chunk starting at p, where len bytes are available.
+     * unless p runs to the end of the data, len should be at least
+     * maxSize */
+    size_t cut(const unsigned char* p, size_t len) const;
+    /* (offset, length) of every chunk of size bytes of file, read front
+     * to back once.  false with err set on a read error */
+    bool boundaries(const NativeFile& file, long long size,
+                    std::vector<std::pair<long long, long long> >& out,
+                    std::string& err) const;
+private:
+    size_t m_min;
+    size_t m_avg;
+    size_t m_max;
+    // harder to satisfy below the average size, easier above it
+    unsigned long long m_maskSmall;
+    unsigned long long m_maskLarge;
+};
+
+#endif
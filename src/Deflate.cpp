@@ -0,0 +1,304 @@
+/**
+ *  A small streaming deflate encoder with gzip and zlib framing.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "Deflate.h"
+#include "Digest.h"
+#include <string.h>
+
+#define DF_WSIZE 32768
+// input buffered ahead of the window, sliding is cheaper the larger this is
+#define DF_BUFSIZE (8 * DF_WSIZE)
+#define DF_MIN_MATCH 3
+#define DF_MAX_MATCH 258
+#define DF_HASH_BITS 15
+#define DF_HASH_SIZE (1 << DF_HASH_BITS)
+// candidates looked at per position, and a match long enough to stop
+// looking.  both trade ratio for speed
+#define DF_MAX_CHAIN 16
+#define DF_NICE_MATCH 32
+// only matches up to this long have their inner positions indexed
+#define DF_MAX_INSERT 8
+
+namespace {
+
+const unsigned short s_lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const unsigned char s_lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const unsigned short s_distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const unsigned char s_distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+unsigned int
+reverseBits(unsigned int v, int n)
+{
+    unsigned int r = 0;
+    for (int i = 0; i < n; i++) {
+        r = (r << 1) | ((v >> i) & 1);
+    }
+    return r;
+}
+
+// the fixed Huffman codes (RFC 1951 3.2.6), bit reversed since deflate
+// packs codes most significant bit first into an lsb first stream
+struct FixedCodes {
+    unsigned short litCode[288];
+    unsigned char litLen[288];
+    unsigned char distCode[30];
+    unsigned char lengthSym[DF_MAX_MATCH + 1];
+    // distance-1 below 256 directly, above that by (distance-1) >> 7
+    unsigned char distSym[512];
+    FixedCodes() {
+        for (int i = 0; i < 288; i++) {
+            unsigned int code;
+            int len;
+            if (i < 144) { code = 0x30 + i; len = 8; }
+            else if (i < 256) { code = 0x190 + (i - 144); len = 9; }
+            else if (i < 280) { code = i - 256; len = 7; }
+            else { code = 0xc0 + (i - 280); len = 8; }
+            litCode[i] = (unsigned short) reverseBits(code, len);
+            litLen[i] = (unsigned char) len;
+        }
+        for (int i = 0; i < 30; i++) {
+            distCode[i] = (unsigned char) reverseBits(i, 5);
+        }
+        for (int s = 0; s < 29; s++) {
+            int top = s == 28 ? DF_MAX_MATCH : s_lengthBase[s] + (1 << s_lengthExtra[s]) - 1;
+            for (int l = s_lengthBase[s]; l <= top && l <= DF_MAX_MATCH; l++) {
+                lengthSym[l] = (unsigned char) s;
+            }
+        }
+        // 258 has a symbol of its own
+        lengthSym[DF_MAX_MATCH] = 28;
+        for (int s = 0; s < 30; s++) {
+            int first = s_distBase[s] - 1, last = first + (1 << s_distExtra[s]) - 1;
+            for (int d = first; d <= last; d++) {
+                if (d < 256) {
+                    distSym[d] = (unsigned char) s;
+                } else {
+                    distSym[256 + (d >> 7)] = (unsigned char) s;
+                }
+            }
+        }
+    }
+};
+
+const FixedCodes s_codes;
+
+inline unsigned int
+hash3(const unsigned char* p)
+{
+    return (((unsigned int) p[0] << 10) ^ ((unsigned int) p[1] << 5) ^ p[2])
+        & (DF_HASH_SIZE - 1);
+}
+
+}
+
+Deflater::Deflater(Format format) :
+    m_format(format), m_started(false), m_window(DF_BUFSIZE),
+    m_pos(0), m_end(0), m_head(DF_HASH_SIZE, -1), m_prev(DF_WSIZE, -1),
+    m_bitBuf(0), m_bitCount(0), m_crc(0), m_adlerA(1), m_adlerB(0),
+    m_total(0) {
+}
+
+void
+Deflater::putBits(unsigned int bits, int count, std::string& out)
+{
+    m_bitBuf |= (unsigned long long) bits << m_bitCount;
+    m_bitCount += count;
+    while (m_bitCount >= 8) {
+        out += (char) (m_bitBuf & 0xff);
+        m_bitBuf >>= 8;
+        m_bitCount -= 8;
+    }
+}
+
+void
+Deflater::putLiteral(unsigned char c, std::string& out)
+{
+    putBits(s_codes.litCode[c], s_codes.litLen[c], out);
+}
+
+void
+Deflater::putMatch(size_t length, size_t distance, std::string& out)
+{
+    int ls = s_codes.lengthSym[length];
+    putBits(s_codes.litCode[257 + ls], s_codes.litLen[257 + ls], out);
+    if (s_lengthExtra[ls]) {
+        putBits((unsigned int) (length - s_lengthBase[ls]), s_lengthExtra[ls], out);
+    }
+    size_t d = distance - 1;
+    int ds = d < 256 ? s_codes.distSym[d] : s_codes.distSym[256 + (d >> 7)];
+    putBits(s_codes.distCode[ds], 5, out);
+    if (s_distExtra[ds]) {
+        putBits((unsigned int) (distance - s_distBase[ds]), s_distExtra[ds], out);
+    }
+}
+
+void
+Deflater::slide()
+{
+    // keep the last window's worth, matches can reach back that far
+    const int shift = DF_BUFSIZE - DF_WSIZE;
+    memmove(&m_window[0], &m_window[shift], DF_WSIZE);
+    m_pos -= shift;
+    m_end -= shift;
+    for (size_t i = 0; i < m_head.size(); i++) {
+        m_head[i] = m_head[i] >= shift ? m_head[i] - shift : -1;
+    }
+    for (size_t i = 0; i < m_prev.size(); i++) {
+        m_prev[i] = m_prev[i] >= shift ? m_prev[i] - shift : -1;
+    }
+}
+
+void
+Deflater::compress(bool flush, std::string& out)
+{
+    size_t limit = flush ? m_end : (m_end > DF_MAX_MATCH ? m_end - DF_MAX_MATCH : 0);
+    if (m_pos >= limit) {
+        return;
+    }
+    // a non-final block with fixed codes
+    putBits(0, 1, out);
+    putBits(1, 2, out);
+    const unsigned char* w = &m_window[0];
+    while (m_pos < limit) {
+        size_t bestLen = 0, bestDist = 0;
+        if (m_pos + DF_MIN_MATCH <= m_end) {
+            unsigned int h = hash3(w + m_pos);
+            size_t maxLen = m_end - m_pos;
+            if (maxLen > DF_MAX_MATCH) maxLen = DF_MAX_MATCH;
+            int cand = m_head[h];
+            for (int chain = 0; chain < DF_MAX_CHAIN && cand >= 0; chain++) {
+                size_t c = (size_t) cand;
+                if (c >= m_pos || m_pos - c > DF_WSIZE) {
+                    break;
+                }
+                if (w[c + bestLen] == w[m_pos + bestLen]) {
+                    size_t l = 0;
+                    while (l < maxLen && w[c + l] == w[m_pos + l]) {
+                        l++;
+                    }
+                    if (l > bestLen) {
+                        bestLen = l;
+                        bestDist = m_pos - c;
+                        if (l >= maxLen || l >= DF_NICE_MATCH) {
+                            break;
+                        }
+                    }
+                }
+                int next = m_prev[c & (DF_WSIZE - 1)];
+                if (next >= cand) {
+                    // overwritten by a newer position
+                    break;
+                }
+                cand = next;
+            }
+            m_prev[m_pos & (DF_WSIZE - 1)] = m_head[h];
+            m_head[h] = (int) m_pos;
+        }
+        if (bestLen >= DF_MIN_MATCH) {
+            putMatch(bestLen, bestDist, out);
+            // index the positions inside short matches too, long ones
+            // are rare and costly to walk
+            for (size_t k = 1; k < bestLen && bestLen <= DF_MAX_INSERT; k++) {
+                size_t p = m_pos + k;
+                if (p + DF_MIN_MATCH <= m_end) {
+                    unsigned int h = hash3(w + p);
+                    m_prev[p & (DF_WSIZE - 1)] = m_head[h];
+                    m_head[h] = (int) p;
+                }
+            }
+            m_pos += bestLen;
+        } else {
+            putLiteral(w[m_pos], out);
+            m_pos++;
+        }
+    }
+    // end of block
+    putBits(s_codes.litCode[256], s_codes.litLen[256], out);
+}
+
+void
+Deflater::write(const void* data, size_t len, std::string& out)
+{
+    if (!m_started) {
+        m_started = true;
+        if (m_format == Gzip) {
+            static const char header[10] = {
+                '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'
+            };
+            out.append(header, sizeof(header));
+        } else {
+            // 32K window, no dictionary, fastest level
+            out += (char) 0x78;
+            out += (char) 0x01;
+        }
+    }
+    const unsigned char* p = (const unsigned char*) data;
+    if (m_format == Gzip) {
+        m_crc = crc32Update(m_crc, p, len);
+    } else {
+        // adler-32, reduced often enough that the sums can't overflow
+        size_t left = len;
+        const unsigned char* q = p;
+        while (left > 0) {
+            size_t n = left < 5552 ? left : 5552;
+            left -= n;
+            while (n--) {
+                m_adlerA += *q++;
+                m_adlerB += m_adlerA;
+            }
+            m_adlerA %= 65521;
+            m_adlerB %= 65521;
+        }
+    }
+    m_total += len;
+    while (len > 0) {
+        if (m_end == m_window.size()) {
+            compress(false, out);
+            slide();
+        }
+        size_t n = m_window.size() - m_end;
+        if (n > len) n = len;
+        memcpy(&m_window[m_end], p, n);
+        m_end += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void
+Deflater::finish(std::string& out)
+{
+    if (!m_started) {
+        write("", 0, out);
+    }
+    compress(true, out);
+    // an empty final block, then pad to a byte
+    putBits(1, 1, out);
+    putBits(1, 2, out);
+    putBits(s_codes.litCode[256], s_codes.litLen[256], out);
+    if (m_bitCount > 0) {
+        putBits(0, 8 - m_bitCount, out);
+    }
+    if (m_format == Gzip) {
+        for (int i = 0; i < 4; i++) out += (char) ((m_crc >> (8 * i)) & 0xff);
+        for (int i = 0; i < 4; i++) out += (char) ((m_total >> (8 * i)) & 0xff);
+    } else {
+        unsigned int adler = (m_adlerB << 16) | m_adlerA;
+        for (int i = 3; i >= 0; i--) out += (char) ((adler >> (8 * i)) & 0xff);
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ *  A small streaming deflate (RFC 1951) encoder with gzip (RFC 1952)
+ *  and zlib (RFC 1950) framing, for compressing responses.  Greedy
+ *  LZ77 matching over a 32K window with hash chains, coded with the
+ *  fixed Huffman tables.  Not as tight as zlib at its default level,
+ *  but fast, bounded in memory and free of dependencies.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __DEFLATE_H__
+#define __DEFLATE_H__
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+class Deflater {
+public:
+    enum Format {
+        Gzip,
+        Zlib
+    };
+    Deflater(Format format);
+    /* compress len more bytes, appending output as it becomes ready to
+     * out.  a write may produce nothing */
+    void write(const void* data, size_t len, std::string& out);
+    /* compress what's left and append the trailer.  the stream is
+     * complete afterwards */
+    void finish(std::string& out);
+private:
+    Deflater(const Deflater&);
+    Deflater& operator=(const Deflater&);
+    /* encode buffered input as one block, keeping enough lookahead for
+     * a full length match unless flushing */
+    void compress(bool flush, std::string& out);
+    void slide();
+    void putBits(unsigned int bits, int count, std::string& out);
+    void putLiteral(unsigned char c, std::string& out);
+    void putMatch(size_t length, size_t distance, std::string& out);
+    Format m_format;
+    bool m_started;
+    /* the last 32K already encoded, then input not yet encoded */
+    std::vector<unsigned char> m_window;
+    // next byte to encode and end of buffered input, indexes into m_window
+    size_t m_pos;
+    size_t m_end;
+    std::vector<int> m_head;
+    std::vector<int> m_prev;
+    unsigned long long m_bitBuf;
+    int m_bitCount;
+    unsigned int m_crc;
+    unsigned int m_adlerA;
+    unsigned int m_adlerB;
+    unsigned long long m_total;
+};
+
+#endif
@@ -0,0 +1,397 @@
+/**
+ *  Message digests computed incrementally over file data.  Straight
+ *  implementations of RFC 1321 (MD5), FIPS 180-2 (SHA-1, SHA-256) and
+ *  the reflected CRC32 used by zlib, eight bytes at a time.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "Digest.h"
+#include <string.h>
+#include <ctype.h>
+
+namespace {
+
+inline unsigned int
+rotl(unsigned int x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+inline unsigned int
+rotr(unsigned int x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+inline unsigned int
+loadLE(const unsigned char* p)
+{
+    return (unsigned int) p[0] | ((unsigned int) p[1] << 8)
+        | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+inline unsigned int
+loadBE(const unsigned char* p)
+{
+    return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16)
+        | ((unsigned int) p[2] << 8) | (unsigned int) p[3];
+}
+
+const unsigned int s_md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+const int s_md5R[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+const unsigned int s_sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// slice-by-8 tables for the reflected polynomial 0xedb88320
+struct CrcTables {
+    unsigned int t[8][256];
+    CrcTables() {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for (unsigned int i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const CrcTables s_crc;
+
+unsigned int
+crc32Raw(unsigned int crc, const unsigned char* p, size_t len)
+{
+    const unsigned int (*t)[256] = s_crc.t;
+    while (len >= 8) {
+        unsigned int a = loadLE(p) ^ crc;
+        unsigned int b = loadLE(p + 4);
+        crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff]
+            ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24]
+            ^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff]
+            ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+void
+appendHex(std::string& s, unsigned char b)
+{
+    static const char hex[] = "0123456789abcdef";
+    s += hex[b >> 4];
+    s += hex[b & 0xf];
+}
+
+}
+
+unsigned int
+crc32Update(unsigned int crc, const void* data, size_t len)
+{
+    return crc32Raw(crc ^ 0xffffffff, (const unsigned char*) data, len) ^ 0xffffffff;
+}
+
+bool
+Digest::parse(const std::string& name, Algorithm& a)
+{
+    std::string n;
+    for (size_t i = 0; i < name.length(); i++) {
+        n += (char) tolower((unsigned char) name[i]);
+    }
+    if (n == "md5") {
+        a = MD5;
+    } else if (n == "sha1" || n == "sha-1") {
+        a = SHA1;
+    } else if (n == "sha256" || n == "sha-256") {
+        a = SHA256;
+    } else if (n == "crc32") {
+        a = CRC32;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char*
+Digest::name(Algorithm a)
+{
+    switch (a) {
+        case MD5: return "md5";
+        case SHA1: return "sha1";
+        case SHA256: return "sha256";
+        case CRC32: return "crc32";
+    }
+    return "";
+}
+
+Digest::Digest(Algorithm a) :
+    m_alg(a), m_crc(0xffffffff), m_length(0), m_blockLen(0) {
+    static const unsigned int md5Init[4] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+    };
+    static const unsigned int sha1Init[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+    static const unsigned int sha256Init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memset(m_h, 0, sizeof(m_h));
+    switch (a) {
+        case MD5: memcpy(m_h, md5Init, sizeof(md5Init)); break;
+        case SHA1: memcpy(m_h, sha1Init, sizeof(sha1Init)); break;
+        case SHA256: memcpy(m_h, sha256Init, sizeof(sha256Init)); break;
+        case CRC32: break;
+    }
+}
+
+void
+Digest::md5Block(const unsigned char* p)
+{
+    unsigned int w[16];
+    for (int i = 0; i < 16; i++) {
+        w[i] = loadLE(p + i * 4);
+    }
+    unsigned int a = m_h[0], b = m_h[1], c = m_h[2], d = m_h[3];
+    for (int i = 0; i < 64; i++) {
+        unsigned int f;
+        int g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+        unsigned int tmp = d;
+        d = c;
+        c = b;
+        b = b + rotl(a + f + s_md5K[i] + w[g], s_md5R[i]);
+        a = tmp;
+    }
+    m_h[0] += a;
+    m_h[1] += b;
+    m_h[2] += c;
+    m_h[3] += d;
+}
+
+void
+Digest::sha1Block(const unsigned char* p)
+{
+    unsigned int w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = loadBE(p + i * 4);
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    unsigned int a = m_h[0], b = m_h[1], c = m_h[2], d = m_h[3], e = m_h[4];
+    // one loop per round function, keeps the branches out of the rounds
+#define SHA1_ROUND(f, k) {                                          \
+        unsigned int tmp = rotl(a, 5) + (f) + e + (k) + w[i];       \
+        e = d; d = c; c = rotl(b, 30); b = a; a = tmp;              \
+    }
+    int i = 0;
+    for (; i < 20; i++) SHA1_ROUND((b & c) | (~b & d), 0x5a827999)
+    for (; i < 40; i++) SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1)
+    for (; i < 60; i++) SHA1_ROUND((b & c) | (b & d) | (c & d), 0x8f1bbcdc)
+    for (; i < 80; i++) SHA1_ROUND(b ^ c ^ d, 0xca62c1d6)
+#undef SHA1_ROUND
+    m_h[0] += a;
+    m_h[1] += b;
+    m_h[2] += c;
+    m_h[3] += d;
+    m_h[4] += e;
+}
+
+void
+Digest::sha256Block(const unsigned char* p)
+{
+    unsigned int w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = loadBE(p + i * 4);
+    }
+    for (int i = 16; i < 64; i++) {
+        unsigned int s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    unsigned int a = m_h[0], b = m_h[1], c = m_h[2], d = m_h[3];
+    unsigned int e = m_h[4], f = m_h[5], g = m_h[6], h = m_h[7];
+    for (int i = 0; i < 64; i++) {
+        unsigned int S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        unsigned int ch = (e & f) ^ (~e & g);
+        unsigned int t1 = h + S1 + ch + s_sha256K[i] + w[i];
+        unsigned int S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        unsigned int maj = (a & b) ^ (a & c) ^ (b & c);
+        unsigned int t2 = S0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    m_h[0] += a;
+    m_h[1] += b;
+    m_h[2] += c;
+    m_h[3] += d;
+    m_h[4] += e;
+    m_h[5] += f;
+    m_h[6] += g;
+    m_h[7] += h;
+}
+
+void
+Digest::update(const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*) data;
+    if (m_alg == CRC32) {
+        m_crc = crc32Raw(m_crc, p, len);
+        return;
+    }
+    m_length += len;
+    while (len > 0) {
+        // whole blocks straight from the caller's buffer
+        if (m_blockLen == 0 && len >= 64) {
+            switch (m_alg) {
+                case MD5: md5Block(p); break;
+                case SHA1: sha1Block(p); break;
+                default: sha256Block(p); break;
+            }
+            p += 64;
+            len -= 64;
+            continue;
+        }
+        size_t n = 64 - m_blockLen;
+        if (n > len) n = len;
+        memcpy(m_block + m_blockLen, p, n);
+        m_blockLen += n;
+        p += n;
+        len -= n;
+        if (m_blockLen == 64) {
+            switch (m_alg) {
+                case MD5: md5Block(m_block); break;
+                case SHA1: sha1Block(m_block); break;
+                default: sha256Block(m_block); break;
+            }
+            m_blockLen = 0;
+        }
+    }
+}
+
+std::string
+Digest::finish()
+{
+    std::string rval;
+    if (m_alg == CRC32) {
+        unsigned int crc = m_crc ^ 0xffffffff;
+        for (int i = 3; i >= 0; i--) {
+            appendHex(rval, (unsigned char) (crc >> (i * 8)));
+        }
+        return rval;
+    }
+    // pad with 0x80, zeros, then the length in bits
+    unsigned long long bits = m_length * 8;
+    unsigned char pad[72];
+    size_t padLen = (m_blockLen < 56 ? 56 : 120) - m_blockLen;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        int shift = (m_alg == MD5) ? i * 8 : (7 - i) * 8;
+        pad[padLen + i] = (unsigned char) (bits >> shift);
+    }
+    update(pad, padLen + 8);
+
+    size_t words = (m_alg == MD5) ? 4 : (m_alg == SHA1) ? 5 : 8;
+    for (size_t i = 0; i < words; i++) {
+        for (int k = 0; k < 4; k++) {
+            int shift = (m_alg == MD5) ? k * 8 : (3 - k) * 8;
+            appendHex(rval, (unsigned char) (m_h[i] >> shift));
+        }
+    }
+    return rval;
+}
+
+DigestSet::DigestSet(unsigned int algorithms) :
+    m_count(0) {
+    static const Digest::Algorithm all[MaxDigests] = {
+        Digest::MD5, Digest::SHA1, Digest::SHA256, Digest::CRC32
+    };
+    for (size_t i = 0; i < MaxDigests; i++) {
+        if (algorithms & all[i]) {
+            m_digests[m_count++] = new Digest(all[i]);
+        }
+    }
+}
+
+DigestSet::~DigestSet() {
+    for (size_t i = 0; i < m_count; i++) {
+        delete m_digests[i];
+    }
+}
+
+void
+DigestSet::update(const void* data, size_t len)
+{
+    for (size_t i = 0; i < m_count; i++) {
+        m_digests[i]->update(data, len);
+    }
+}
+
+std::map<std::string, std::string>
+DigestSet::finish()
+{
+    std::map<std::string, std::string> rval;
+    for (size_t i = 0; i < m_count; i++) {
+        rval[Digest::name(m_digests[i]->algorithm())] = m_digests[i]->finish();
+    }
+    return rval;
+}
@@ -0,0 +1,69 @@
+/**
+ *  Message digests computed incrementally over file data: MD5, SHA-1,
+ *  SHA-256 and CRC32 (the zlib/ethernet polynomial).  A DigestSet feeds
+ *  the same bytes to several at once, so that one pass over a file can
+ *  produce all of the digests a caller asked for.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include <map>
+#include <string>
+#include <stddef.h>
+
+class Digest {
+public:
+    /* values may be or'd together to describe a set of digests */
+    enum Algorithm {
+        MD5 = 1,
+        SHA1 = 2,
+        SHA256 = 4,
+        CRC32 = 8
+    };
+    /* "md5", "sha1", "sha256" or "crc32", case insensitive.  false if
+     * the name isn't recognized */
+    static bool parse(const std::string& name, Algorithm& a);
+    static const char* name(Algorithm a);
+
+    Digest(Algorithm a);
+    Algorithm algorithm() const { return m_alg; }
+    void update(const void* data, size_t len);
+    /* lowercase hex of the digest.  ends the computation */
+    std::string finish();
+private:
+    void md5Block(const unsigned char* p);
+    void sha1Block(const unsigned char* p);
+    void sha256Block(const unsigned char* p);
+    Algorithm m_alg;
+    unsigned int m_h[8];
+    unsigned int m_crc;
+    unsigned long long m_length;
+    unsigned char m_block[64];
+    size_t m_blockLen;
+};
+
+/* continue a CRC32 over len more bytes, starting from 0.  the same
+ * value zlib's crc32() gives */
+unsigned int crc32Update(unsigned int crc, const void* data, size_t len);
+
+/* several digests of the same data */
+class DigestSet {
+public:
+    /* algorithms is a mask of Digest::Algorithm values */
+    DigestSet(unsigned int algorithms);
+    ~DigestSet();
+    void update(const void* data, size_t len);
+    /* digest name -> lowercase hex */
+    std::map<std::string, std::string> finish();
+private:
+    DigestSet(const DigestSet&);
+    DigestSet& operator=(const DigestSet&);
+    enum { MaxDigests = 4 };
+    Digest* m_digests[MaxDigests];
+    size_t m_count;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ *  Thin wrappers around native file handles, for the places where
+ *  std::fstream costs us extra copies or syscalls.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __FILEIO_H__
+#define __FILEIO_H__
+
+#include <boost/filesystem.hpp>
+#include <stddef.h>
+
+/* what identifies a particular version of a file's contents */
+struct FileIdentity {
+    long long m_size;
+    /* last modification, seconds since the epoch and nanoseconds within
+     * that second (as fine as the platform records it), so rewrites
+     * within a second still change the identity */
+    long long m_mtime;
+    long long m_mtimeNsec;
+    unsigned long long m_device;
+    unsigned long long m_inode;
+    bool operator==(const FileIdentity& o) const {
+        return m_size == o.m_size && m_mtime == o.m_mtime
+            && m_mtimeNsec == o.m_mtimeNsec && m_device == o.m_device && m_inode == o.m_inode;
+    }
+    bool operator!=(const FileIdentity& o) const { return !(*this == o); }
+};
+
+class NativeFile {
+public:
+    NativeFile();
+    ~NativeFile();
+    /* open an existing file for reading, false on error */
+    bool openRead(const boost::filesystem::path& path);
+    /* create (or truncate) a file for writing, false on error */
+    bool openWrite(const boost::filesystem::path& path);
+    void close();
+    bool isOpen() const;
+    /* current size of the file, -1 on error */
+    long long size() const;
+    /* size, modification time and device/inode (volume/file index on
+     * windows) of the open file, false on error */
+    bool identity(FileIdentity& id) const;
+    /* positional i/o, the file pointer is not used.  returns the number
+     * of bytes transferred (which may be short), -1 on error */
+    long long readAt(void* buf, size_t len, long long offset) const;
+    long long writeAt(const void* buf, size_t len, long long offset) const;
+#ifdef WIN32
+    void* handle() const { return m_handle; }
+#else
+    int fd() const { return m_fd; }
+#endif
+private:
+    NativeFile(const NativeFile&);
+    NativeFile& operator=(const NativeFile&);
+#ifdef WIN32
+    void* m_handle;
+#else
+    int m_fd;
+#endif
+};
+
+/* identity of the file currently at path, without keeping it open.
+ * false if there's nothing there */
+bool pathIdentity(const boost::filesystem::path& path, FileIdentity& id);
+
+/* copy len bytes from src at srcOffset to dst at dstOffset without
+ * bouncing the data through user space, sharing extents with the source
+ * where the filesystem allows it.  returns the number of bytes copied,
+ * which may be less than len (or 0) where the platform or filesystem
+ * can't help; the caller is expected to finish the remainder itself. */
+long long copyFileRange(const NativeFile& src, long long srcOffset,
+                        const NativeFile& dst, long long dstOffset,
+                        long long len);
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ *  Thin wrappers around native file handles, for the places where
+ *  std::fstream costs us extra copies or syscalls.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "FileIO.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+NativeFile::NativeFile() : m_fd(-1) {
+}
+
+NativeFile::~NativeFile() {
+    close();
+}
+
+bool
+NativeFile::openRead(const boost::filesystem::path& path) {
+    close();
+    do {
+        m_fd = ::open(path.c_str(), O_RDONLY);
+    } while (m_fd < 0 && errno == EINTR);
+    return m_fd >= 0;
+}
+
+bool
+NativeFile::openWrite(const boost::filesystem::path& path) {
+    close();
+    do {
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    } while (m_fd < 0 && errno == EINTR);
+    return m_fd >= 0;
+}
+
+void
+NativeFile::close() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool
+NativeFile::isOpen() const {
+    return m_fd >= 0;
+}
+
+long long
+NativeFile::size() const {
+    struct stat sb;
+    if (m_fd < 0 || fstat(m_fd, &sb) != 0) {
+        return -1;
+    }
+    return (long long) sb.st_size;
+}
+
+static long long
+mtimeNsec(const struct stat& sb)
+{
+#if defined(__APPLE__)
+    return (long long) sb.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    return (long long) sb.st_mtim.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+bool
+NativeFile::identity(FileIdentity& id) const {
+    struct stat sb;
+    if (m_fd < 0 || fstat(m_fd, &sb) != 0) {
+        return false;
+    }
+    id.m_size = (long long) sb.st_size;
+    id.m_mtime = (long long) sb.st_mtime;
+    id.m_mtimeNsec = mtimeNsec(sb);
+    id.m_device = (unsigned long long) sb.st_dev;
+    id.m_inode = (unsigned long long) sb.st_ino;
+    return true;
+}
+
+bool
+pathIdentity(const boost::filesystem::path& path, FileIdentity& id) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0) {
+        return false;
+    }
+    id.m_size = (long long) sb.st_size;
+    id.m_mtime = (long long) sb.st_mtime;
+    id.m_mtimeNsec = mtimeNsec(sb);
+    id.m_device = (unsigned long long) sb.st_dev;
+    id.m_inode = (unsigned long long) sb.st_ino;
+    return true;
+}
+
+long long
+NativeFile::readAt(void* buf, size_t len, long long offset) const {
+    ssize_t rd;
+    do {
+        rd = ::pread(m_fd, buf, len, (off_t) offset);
+    } while (rd < 0 && errno == EINTR);
+    return (long long) rd;
+}
+
+long long
+NativeFile::writeAt(const void* buf, size_t len, long long offset) const {
+    ssize_t wr;
+    do {
+        wr = ::pwrite(m_fd, buf, len, (off_t) offset);
+    } while (wr < 0 && errno == EINTR);
+    return (long long) wr;
+}
+
+long long
+copyFileRange(const NativeFile& src, long long srcOffset,
+              const NativeFile& dst, long long dstOffset,
+              long long len)
+{
+    long long copied = 0;
+    if (!src.isOpen() || !dst.isOpen() || len <= 0) {
+        return 0;
+    }
+#ifdef __linux__
+#ifdef FICLONERANGE
+    // reflink the extents when offsets are block aligned and the range
+    // either is too, or runs to the end of the source.  this is free on
+    // btrfs/xfs and fails quickly (EOPNOTSUPP/EXDEV/EINVAL) elsewhere.
+    struct stat sb;
+    if (fstat(src.fd(), &sb) == 0 && sb.st_blksize > 0) {
+        long long bs = (long long) sb.st_blksize;
+        bool toEof = (srcOffset + len == (long long) sb.st_size);
+        if (srcOffset % bs == 0 && dstOffset % bs == 0
+            && (len % bs == 0 || toEof))
+        {
+            struct file_clone_range fcr;
+            fcr.src_fd = src.fd();
+            fcr.src_offset = (unsigned long long) srcOffset;
+            fcr.src_length = toEof ? 0 : (unsigned long long) len;
+            fcr.dest_offset = (unsigned long long) dstOffset;
+            if (ioctl(dst.fd(), FICLONERANGE, &fcr) == 0) {
+                return len;
+            }
+        }
+    }
+#endif
+#ifdef __NR_copy_file_range
+    // in kernel copy, which may still share extents (nfs, xfs, ...)
+    while (copied < len) {
+        loff_t in = (loff_t) (srcOffset + copied);
+        loff_t out = (loff_t) (dstOffset + copied);
+        long long want = len - copied;
+        if (want > (1 << 30)) {
+            want = (1 << 30);
+        }
+        long n = syscall(__NR_copy_file_range, src.fd(), &in, dst.fd(), &out,
+                         (size_t) want, 0u);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // ENOSYS, EXDEV on older kernels, or a short source
+            break;
+        }
+        copied += n;
+    }
+#endif
+#endif
+    return copied;
+}
@@ -0,0 +1,113 @@
+/**
+ *  Reads of byte ranges of a file as text or base64.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "FileRead.h"
+#include "base64.h"
+#include <string.h>
+
+bool
+readFileContents(const boost::filesystem::path& path, long long offset, long long size,
+                 bool base64, FileContents& out, std::string& err)
+{
+    // verify size is reasonable
+    if (size > FA_MAX_READ) {
+        err = "size too large, greater than 2mb limit";
+        return false;
+    }
+    // set to 2mb if 
+    if (size < 0) {
+        size = FA_MAX_READ;
+    }
+    // verify file exists and open
+    NativeFile file;
+    if (!file.openRead(path)) {
+        err = "cannot open file for reading";
+        return false;
+    }
+    // now validate offset and size
+    long long fileSize = file.size();
+    if (fileSize < 0) {
+        err = "read error";
+        return false;
+    }
+    if (offset < 0 || offset > fileSize) {
+        err = "offset out of range";        
+        return false;
+    }
+    // now set size to exact amount required
+    if (fileSize - offset < size) {
+        size = fileSize - offset;
+    }
+    if (size == 0) {
+        return true;
+    }
+    return readRange(file, offset, (size_t)size, base64, out, err);
+}
+
+bool
+readRange(const NativeFile& file, long long offset, size_t size,
+          bool base64, FileContents& out, std::string& err)
+{
+    out.m_buffer.clear();
+    // size the result once and read (or encode) into it
+    std::string& buf = out.m_buffer;
+    size_t total = 0;
+    if (base64) {
+        buf.resize(Base64::encodedLength(size));
+        // stream through a small block, a multiple of 3 so padding can
+        // only land at the very end
+        unsigned char block[3 * 1024 * 4];
+        size_t numRead = 0;
+        while (numRead < size) {
+            size_t want = size - numRead;
+            if (want > sizeof(block)) {
+                want = sizeof(block);
+            }
+            long long rd = file.readAt(block, want, offset + (long long)numRead);
+            if (rd < 0) {
+                err = "read error";
+                return false;
+            }
+            if (rd == 0) {
+                break;
+            }
+            if ((size_t)rd < want && numRead + (size_t)rd < size && rd % 3 != 0) {
+                // keep blocks a multiple of 3, re-read the remainder next time
+                rd -= rd % 3;
+            }
+            total += Base64::encode(block, (size_t)rd, &buf[total]);
+            numRead += (size_t)rd;
+        }
+        buf.resize(total);
+        return true;
+    }
+    buf.resize(size);
+    while (total < size) {
+        long long rd = file.readAt(&buf[total], size - total, offset + (long long)total);
+        if (rd < 0) {
+            err = "read error";
+            return false;
+        }
+        if (rd == 0) {
+            break;
+        }
+        total += (size_t)rd;
+    }
+    buf.resize(total);
+    return checkText((const unsigned char*)buf.data(), total, err);
+}
+
+bool
+checkText(const unsigned char* bytes, size_t len, std::string& err)
+{
+    // any encoding will do (latin-1 say), only embedded NULs are refused
+    if (memchr(bytes, 0, len) != NULL) {
+        // no support for "binary data" --> embedded nulls
+        err = "binary data not supported";
+        return false;
+    }
+    return true;
+}
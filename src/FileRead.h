@@ -0,0 +1,41 @@
+/**
+ *  Reads of byte ranges of a file as text or base64, as handed back by
+ *  read, readBase64, readStream and readMany.  Ranges are read into a
+ *  buffer sized once up front, rather than mapped: the files are the
+ *  user's, and one truncated by another process while mapped would
+ *  raise SIGBUS instead of a short read.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __FILEREAD_H__
+#define __FILEREAD_H__
+
+#include "FileIO.h"
+#include <boost/filesystem.hpp>
+#include <string>
+
+// 2mb is max allowable read
+#define FA_MAX_READ (1<<21)
+
+/* the bytes of a read */
+struct FileContents {
+    std::string m_buffer;
+    const char* data() const { return m_buffer.data(); }
+    size_t length() const { return m_buffer.length(); }
+};
+
+/* read (and optionally base64 encode) size bytes at offset into out,
+ * size < 0 meaning as much as a read allows.  false with err set on
+ * failure */
+bool readFileContents(const boost::filesystem::path& path, long long offset, long long size,
+                      bool base64, FileContents& out, std::string& err);
+/* as above for size bytes at offset of an already open file, which
+ * the caller has validated against its size */
+bool readRange(const NativeFile& file, long long offset, size_t size,
+               bool base64, FileContents& out, std::string& err);
+/* verify bytes are text we can hand back as a string (no embedded
+ * NULs), setting err if not.  text needn't be UTF-8 */
+bool checkText(const unsigned char* bytes, size_t len, std::string& err);
+
+#endif
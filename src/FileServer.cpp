@@ -6,21 +6,76 @@
  */
 
 #include "FileServer.h"
+#include "ParallelCopy.h"
+#include "ContentChunker.h"
+#include "Digest.h"
 #include "bpservice/bpservice.h"
 #include "littleuuid.h"
 #include <mongoose/mongoose.h>
+#include <boost/algorithm/string.hpp>
 #include <sstream>
+#include <iomanip>
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define FS_MAX_TEMP_FILES 1024
 #define FS_MAX_TEMP_BYTES 1024 * 1024 * 512
 #define BUFSIZE 1024 * 8
+// chunk and slice files are reclaimed this long after creation
+#define FS_TEMP_MAX_AGE (60 * 60)
+// files can change under a url at any time, so make browsers check
+// before reusing what they have (a 304 when nothing changed)
+#define FS_CACHE_CONTROL "private, no-cache"
+// persistent connection defaults: seconds a client may hold an idle
+// connection, and requests served on one before it's closed
+#define FS_KEEPALIVE_IDLE 15
+#define FS_KEEPALIVE_MAX_REQUESTS 100
+// connections remembered before idle ones are forgotten
+#define FS_MAX_TRACKED_CONNECTIONS 256
+// smallest response worth compressing
+#define FS_COMPRESS_MIN_SIZE 1024
+// most threads used to write the chunks of one file
+#define FS_MAX_CHUNK_THREADS 8
+// chunk/slice results remembered for unchanged files
+#define FS_MAX_CACHED_RESULTS 256
+// bound on outstanding urls, least recently used go first
+#define FS_MAX_TOKENS (1024 * 16)
+// open handles kept on served files, and seconds between checks that a
+// handle's path still names the file it has open
+#define FS_MAX_OPEN_HANDLES 64
+#define FS_HANDLE_RECHECK 2
+// urls that go unrequested this long are forgotten
+#define FS_TOKEN_IDLE_TTL (60 * 60 * 12)
+// urls are forgotten this long after creation, 0 means never
+#define FS_TOKEN_LIFETIME 0
+// most bytes of a file read and handed to the connection at once when
+// serving it, and the size of the buffer used for compression
+#define FS_SEND_WINDOW (256 * 1024)
+#define FS_IO_BUFFER (64 * 1024)
+// reserved path answered with the metrics, never a token
+#define FS_STATS_PATH "/__stats"
+
+#ifdef WIN32
+#define strtoll _strtoi64
+#endif
 
 FileServer* FileServer::s_self = NULL;
 
 FileServer::FileServer(const boost::filesystem::path& tempDir) :
+    m_tokens(FS_MAX_TOKENS),
+    m_handles(FS_MAX_OPEN_HANDLES, FS_HANDLE_RECHECK),
     m_tempDir(tempDir),
     m_limit(FS_MAX_TEMP_FILES, FS_MAX_TEMP_BYTES),
+    m_compress(true),
+    m_compressCache(true),
+    m_threads(0),
+    m_sendWindow(FS_SEND_WINDOW),
+    m_ioBuffer(FS_IO_BUFFER),
+    m_keepAliveIdle(FS_KEEPALIVE_IDLE),
+    m_keepAliveMax(FS_KEEPALIVE_MAX_REQUESTS),
     m_ctx(NULL) {
     assert(FileServer::s_self == NULL);
     FileServer::s_self = NULL;
@@ -43,8 +98,15 @@ std::string
 FileServer::start() {
     std::stringstream boundTo;
     m_port = 0;
+    std::stringstream ss;
+    ss << m_threads;
+    // options point into this, it has to outlive mg_create
+    std::string threads = ss.str();
     const char* options[] = {
       "listening_ports", "0",
+      "enable_keep_alive", m_keepAliveMax ? "yes" : "no",
+      // leave the server's default alone unless told otherwise
+      m_threads ? "num_threads" : NULL, threads.c_str(),
       NULL
     };
     m_ctx = mg_create(&FileServer::mongooseCallback, NULL, options);
@@ -62,23 +124,160 @@ FileServer::start() {
     return boundTo.str();
 }
 
+void
+FileServer::setKeepAlive(unsigned int idleTimeout, unsigned int maxRequests) {
+    assert(m_ctx == NULL);
+    m_keepAliveIdle = idleTimeout;
+    m_keepAliveMax = maxRequests;
+}
+
+void
+FileServer::setCompression(bool enabled, bool cache) {
+    m_compress = enabled;
+    m_compressCache = cache;
+}
+
+void
+FileServer::setThreads(unsigned int threads) {
+    assert(m_ctx == NULL);
+    m_threads = threads;
+}
+
+void
+FileServer::setSendSizes(size_t sendWindow, size_t ioBuffer) {
+    if (sendWindow) {
+        m_sendWindow = sendWindow;
+    }
+    if (ioBuffer) {
+        m_ioBuffer = ioBuffer;
+    }
+}
+
+void
+FileServer::setTempLimits(size_t files, size_t bytes) {
+    m_limit.setLimits(files, bytes);
+}
+
 std::string
-FileServer::addFile(const boost::filesystem::path& path) {
+FileServer::addFile(const boost::filesystem::path& path,
+                    long long offset, long long size,
+                    long idleTimeout, long lifetime)
+{
     // generate a nice random url path
     std::stringstream url;    
     std::string uuid;
     uuid_generate(uuid);
     url << "http://127.0.0.1:" << m_port << "/" << uuid;
-    {
-        bplus::sync::Lock lck(m_lock);
-        m_paths[uuid] = path;
+    Token token;
+    if (!Token::parse(uuid, token)) {
+        bplus::service::Service::log(BP_ERROR, "malformed uuid generated: " + uuid);
+        return std::string();
     }
+    ServedFile sf;
+    sf.m_path = path;
+    sf.m_offset = offset;
+    sf.m_size = size;
+    std::vector<std::string> mts = bp::file::mimeTypes(path);
+    if (mts.size() > 0) {
+        sf.m_mimeType = *mts.begin();
+    }
+    if (idleTimeout < 0) {
+        idleTimeout = FS_TOKEN_IDLE_TTL;
+    }
+    if (lifetime < 0) {
+        lifetime = FS_TOKEN_LIFETIME;
+    }
+    m_tokens.insert(token, sf, (unsigned int) idleTimeout, (unsigned int) lifetime);
     bplus::service::Service::log(BP_DEBUG, "m_urls[" + uuid + "] = " + path.string());
     return url.str();
 }
 
+bool
+FileServer::removeFile(const std::string& url) {
+    // the token is the first path component, as in mongooseCallback
+    size_t start = url.find("://");
+    start = url.find('/', (start == std::string::npos) ? 0 : start + 3);
+    if (start == std::string::npos) {
+        return false;
+    }
+    std::string id = url.substr(start + 1);
+    size_t end = id.find_first_of("/?#");
+    if (end != std::string::npos) {
+        id = id.substr(0, end);
+    }
+    Token token;
+    if (!Token::parse(id, token)) {
+        return false;
+    }
+    bplus::service::Service::log(BP_DEBUG, "revoking " + id);
+    ServedFile served;
+    if (!m_tokens.remove(token, &served)) {
+        return false;
+    }
+    // don't hold the file open on behalf of a url that's gone.  other urls
+    // for it just reopen it
+    m_handles.forget(served.m_path);
+    return true;
+}
+
+// finishes each chunk's digests and hands it to a ChunkListener as the
+// range that fills it is copied
+class ChunkNotifier : public RangeCopyListener {
+public:
+    ChunkNotifier(const std::vector<RangeCopy>& ranges, std::vector<ChunkInfo>& chunks,
+                  ChunkListener* listener) :
+        m_ranges(ranges), m_chunks(chunks), m_listener(listener) {
+    }
+    virtual void rangeCopied(size_t index) {
+        if (m_ranges[index].m_digests) {
+            m_chunks[index].m_digests = m_ranges[index].m_digests->finish();
+        }
+        if (m_listener) {
+            m_listener->chunkReady(m_chunks[index]);
+        }
+    }
+private:
+    const std::vector<RangeCopy>& m_ranges;
+    std::vector<ChunkInfo>& m_chunks;
+    ChunkListener* m_listener;
+};
+
+// one pass over the chunks' ranges of file, writing those with a
+// destination and digesting them, in parallel.  false with err set on
+// failure
+static bool
+produceChunks(const NativeFile& file, std::vector<RangeCopy>& ranges,
+              std::vector<ChunkInfo>& chunks, unsigned int digests,
+              ChunkListener* listener, std::string& err)
+{
+    for (size_t i = 0; i < ranges.size(); i++) {
+        ranges[i].m_digests = digests ? new DigestSet(digests) : NULL;
+    }
+    unsigned int threads = processorCount();
+    if (threads > FS_MAX_CHUNK_THREADS) threads = FS_MAX_CHUNK_THREADS;
+    ChunkNotifier notifier(ranges, chunks, listener);
+    bool ok = copyRanges(file, ranges, threads, err,
+                         (listener || digests) ? &notifier : NULL);
+    for (size_t i = 0; i < ranges.size(); i++) {
+        delete ranges[i].m_digests;
+        ranges[i].m_digests = NULL;
+    }
+    return ok;
+}
+
+static void
+notifyChunks(ChunkListener* listener, const std::vector<ChunkInfo>& chunks)
+{
+    if (listener) {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            listener->chunkReady(chunks[i]);
+        }
+    }
+}
+
 std::vector<ChunkInfo>
-FileServer::getFileChunks(const boost::filesystem::path& path, size_t chunkSize) {
+FileServer::getFileChunks(const boost::filesystem::path& path, size_t chunkSize,
+                          ChunkListener* listener, unsigned int digests) {
     if (m_tempDir.empty()) {
         throw std::string("no temp dir set, internal error");        
     }
@@ -88,88 +287,248 @@ FileServer::getFileChunks(const boost::filesystem::path& path, size_t chunkSize)
         throw std::string("unable to create temp dir");
     }
     std::vector<ChunkInfo> rval;
-    std::ifstream fstream;
-    if (!bp::file::openReadableStream(fstream, path, std::ios_base::in | std::ios_base::binary)) {
+    NativeFile file;
+    FileIdentity id;
+    if (!file.openRead(path) || !file.identity(id)) {
         throw std::string("cannot open file for reading");
     }
     // get filesize
-    fstream.seekg(0, std::ios::end);
-    size_t size = (size_t) fstream.tellg();
-    fstream.seekg(0, std::ios::beg);
-    bplus::service::Service::log(BP_DEBUG, "file size = " + size);
-    if (size <= 0) {
+    size_t size = (size_t) id.m_size;
+    if (size <= 0 || chunkSize == 0) {
         throw std::string("chunk size is invalid");
     }
-    // check resource usage
-    if (m_limit.wouldExceed(size / chunkSize, size)) {
-        throw std::string("allowed resources exceeded");
-    }
     // if file fits in a single chunk, just return the file
     if (size <= chunkSize) {
-        ChunkInfo i = { path, 1, 1 };
+        ChunkInfo i = { path, 0, 1, 0, (long long) size };
         rval.push_back(i);
+        if (!digests) {
+            notifyChunks(listener, rval);
+            return rval;
+        }
+        RangeCopy r = { 0, (long long) size, boost::filesystem::path(), NULL };
+        std::vector<RangeCopy> ranges(1, r);
+        std::string err;
+        if (!produceChunks(file, ranges, rval, digests, listener, err)) {
+            throw err;
+        }
         return rval;
     }
-    char* buf = new char[chunkSize];
-    if (!buf) {
-        throw std::string("unable to allocate memory");
+    // unchanged since we last chunked it the same way?
+    collectTempFiles();
+    std::string key = cacheKey("chunk", path, id, (long long) chunkSize, digests);
+    if (findCached(key, rval)) {
+        bplus::service::Service::log(BP_DEBUG, "chunks cached for " + path.string());
+        notifyChunks(listener, rval);
+        return rval;
     }
-    try {
-        size_t chunkNumber = 0;
-        size_t totalRead = 0;
-        while (totalRead < size) {
-            // read a chunk
-            fstream.read(buf, chunkSize);
-            if (fstream.bad()) {
-                throw std::string("error reading file");
-            }
-            size_t numRead = (size_t)fstream.gcount();
-            totalRead += numRead;
-            std::stringstream ss1;
-            ss1 << "read " << numRead << ", totalRead = " << totalRead;
-            bplus::service::Service::log(BP_DEBUG, ss1.str());
-            // write chunk to a file
-            std::stringstream ss2;
-            ss2 << path.filename().string() << "_chunk-" << chunkNumber << "_";
-            boost::filesystem::path p = bp::file::getTempPath(m_tempDir, ss2.str());
-            bplus::service::Service::log(BP_DEBUG, "chunk file: " + p.string());
-            std::ofstream ofs;
-            if (!bp::file::openWritableStream(ofs, p, std::ios_base::out | std::ios_base::binary)) {
-                throw std::string("unable to open temp chunk file");
-            }
-            ofs.write(buf, numRead);
-            if (ofs.bad()) {
-                throw std::string("error writing to temp chunk file");
-            }
-            ofs.close();
-            ChunkInfo info;
-            info.m_path = p;
-            info.m_chunkNumber = chunkNumber++;
-            rval.push_back(info);
-        }
+    std::vector<std::pair<long long, long long> > bounds;
+    for (long long off = 0; off < (long long) size; off += (long long) chunkSize) {
+        long long len = (long long) size - off;
+        if (len > (long long) chunkSize) len = (long long) chunkSize;
+        bounds.push_back(std::make_pair(off, len));
+    }
+    return writeChunks(path, file, bounds, key, listener, digests);
+}
+
+std::vector<ChunkInfo>
+FileServer::writeChunks(const boost::filesystem::path& path, const NativeFile& file,
+                        const std::vector<std::pair<long long, long long> >& bounds,
+                        const std::string& key, ChunkListener* listener,
+                        unsigned int digests)
+{
+    // reserve resources for all the chunks up front
+    size_t numberOfChunks = bounds.size();
+    long long size = 0;
+    for (size_t n = 0; n < numberOfChunks; n++) {
+        size += bounds[n].second;
+    }
+    if (!m_limit.tryReserve(numberOfChunks, size)) {
+        throw std::string("allowed resources exceeded");
+    }
+    // name every chunk up front, the workers only fill them in
+    std::vector<ChunkInfo> rval;
+    std::vector<RangeCopy> ranges;
+    for (size_t n = 0; n < numberOfChunks; n++) {
+        RangeCopy r;
+        r.m_offset = bounds[n].first;
+        r.m_size = bounds[n].second;
+        std::stringstream ss;
+        ss << path.filename().string() << "_chunk-" << n << "_";
+        r.m_dest = bp::file::getTempPath(m_tempDir, ss.str());
+        r.m_digests = NULL;
+        bplus::service::Service::log(BP_DEBUG, "chunk file: " + r.m_dest.string());
+        ranges.push_back(r);
+
+        ChunkInfo info = { r.m_dest, n, numberOfChunks, 0, r.m_size };
+        rval.push_back(info);
+    }
+    std::string err;
+    if (!produceChunks(file, ranges, rval, digests, listener, err)) {
         for (size_t i = 0; i < rval.size(); i++) {
-            rval[i].m_numberOfChunks = chunkNumber;
+            bp::file::safeRemove(rval[i].m_path);
+        }
+        m_limit.release(numberOfChunks, size);
+        throw err;
+    }
+    // track the chunks so their usage can be reclaimed, and remember them
+    // in case we're asked again
+    for (size_t i = 0; i < rval.size(); i++) {
+        addTempFile(rval[i].m_path, rval[i].m_size);
+    }
+    storeCached(key, rval);
+    return rval;
+}
+
+std::vector<ChunkInfo>
+FileServer::getContentChunks(const boost::filesystem::path& path,
+                             size_t minSize, size_t avgSize, size_t maxSize,
+                             bool copy, ChunkListener* listener, unsigned int digests)
+{
+    if (!ContentChunker::validSizes(minSize, avgSize, maxSize)) {
+        throw std::string("chunk size is invalid");
+    }
+    NativeFile file;
+    FileIdentity id;
+    if (!file.openRead(path) || !file.identity(id)) {
+        throw std::string("cannot open file for reading");
+    }
+    if (id.m_size <= 0) {
+        throw std::string("chunk size is invalid");
+    }
+    // the point of these chunks is recognizing them, which takes a
+    // strong hash
+    if (!digests) {
+        digests = Digest::SHA256;
+    }
+    std::string key;
+    std::vector<ChunkInfo> rval;
+    if (copy) {
+        if (m_tempDir.empty()) {
+            throw std::string("no temp dir set, internal error");
+        }
+        try {
+            boost::filesystem::create_directories(m_tempDir);
+        } catch (const boost::filesystem::filesystem_error&) {
+            throw std::string("unable to create temp dir");
+        }
+        collectTempFiles();
+        std::stringstream op;
+        op << "cdc:" << minSize << ":" << avgSize << ":" << maxSize;
+        key = cacheKey(op.str().c_str(), path, id, 0, digests);
+        if (findCached(key, rval)) {
+            bplus::service::Service::log(BP_DEBUG, "chunks cached for " + path.string());
+            notifyChunks(listener, rval);
+            return rval;
+        }
+    }
+    ContentChunker chunker(minSize, avgSize, maxSize);
+    std::vector<std::pair<long long, long long> > bounds;
+    std::string err;
+    if (!chunker.boundaries(file, id.m_size, bounds, err)) {
+        throw err;
+    }
+    if (copy) {
+        return writeChunks(path, file, bounds, key, listener, digests);
+    }
+    // views onto the source, read once more to digest them
+    std::vector<RangeCopy> ranges;
+    for (size_t n = 0; n < bounds.size(); n++) {
+        ChunkInfo info = { path, n, bounds.size(), bounds[n].first, bounds[n].second };
+        rval.push_back(info);
+        RangeCopy r = { bounds[n].first, bounds[n].second, boost::filesystem::path(), NULL };
+        ranges.push_back(r);
+    }
+    if (!produceChunks(file, ranges, rval, digests, listener, err)) {
+        throw err;
+    }
+    return rval;
+}
+
+std::vector<ChunkInfo>
+FileServer::getVirtualChunks(const boost::filesystem::path& path, size_t chunkSize,
+                             ChunkListener* listener, unsigned int digests) {
+    NativeFile file;
+    if (!file.openRead(path)) {
+        throw std::string("cannot open file for reading");
+    }
+    long long size = file.size();
+    if (size <= 0) {
+        throw std::string("chunk size is invalid");
+    }
+    if (chunkSize == 0) {
+        throw std::string("chunk size is invalid");
+    }
+    // no data is touched, so there are no resources to charge
+    std::vector<ChunkInfo> rval;
+    size_t numberOfChunks = (size_t) ((size + (long long) chunkSize - 1) / (long long) chunkSize);
+    if ((long long) chunkSize >= size) {
+        numberOfChunks = 1;
+    }
+    rval.reserve(numberOfChunks);
+    for (size_t i = 0; i < numberOfChunks; i++) {
+        ChunkInfo info;
+        info.m_path = path;
+        info.m_chunkNumber = i;
+        info.m_numberOfChunks = numberOfChunks;
+        info.m_offset = (long long) i * (long long) chunkSize;
+        info.m_size = size - info.m_offset;
+        if (info.m_size > (long long) chunkSize) {
+            info.m_size = (long long) chunkSize;
         }
-    } catch (const std::string& e) {
-        delete [] buf;
-        throw(e);
+        rval.push_back(info);
+    }
+    if (!digests) {
+        notifyChunks(listener, rval);
+        return rval;
+    }
+    std::vector<RangeCopy> ranges;
+    for (size_t i = 0; i < rval.size(); i++) {
+        RangeCopy r = { rval[i].m_offset, rval[i].m_size, boost::filesystem::path(), NULL };
+        ranges.push_back(r);
+    }
+    std::string err;
+    if (!produceChunks(file, ranges, rval, digests, listener, err)) {
+        throw err;
     }
-    delete [] buf;
-    // update usage:
-    m_limit.noteUsage(size / chunkSize, size);
     return rval;
 }
 
+std::map<std::string, std::string>
+FileServer::getDigests(const boost::filesystem::path& path,
+                       long long offset, long long size, unsigned int digests)
+{
+    NativeFile file;
+    if (!file.openRead(path)) {
+        throw std::string("cannot open file for reading");
+    }
+    long long fileSize = file.size();
+    if (fileSize < 0) {
+        throw std::string("cannot determine file size");
+    }
+    if (offset < 0 || offset > fileSize) {
+        throw std::string("offset is beyond end of file");
+    }
+    if (size < 0 || size > fileSize - offset) {
+        size = fileSize - offset;
+    }
+    DigestSet set(digests);
+    RangeCopy r = { offset, size, boost::filesystem::path(), &set };
+    std::vector<RangeCopy> ranges(1, r);
+    std::string err;
+    if (!copyRanges(file, ranges, 1, err)) {
+        throw err;
+    }
+    return set.finish();
+}
+
 boost::filesystem::path
 FileServer::getSlice(const boost::filesystem::path& path,
-                     size_t offset, size_t size)
+                     long long offset, long long size)
 {
     if (m_tempDir.empty()) {
         throw std::string("no temp dir set, internal error");        
     }
 
-    char buf[BUFSIZE];
-
     try {
         boost::filesystem::create_directories(m_tempDir);
     } catch (const boost::filesystem::filesystem_error&) {
@@ -178,64 +537,787 @@ FileServer::getSlice(const boost::filesystem::path& path,
 
     boost::filesystem::path s;
 
-    std::ifstream fstream;
-    if (!bp::file::openReadableStream(fstream, path, 
-                                      std::ios_base::in | std::ios_base::binary))
-    {
+    NativeFile in;
+    FileIdentity id;
+    if (!in.openRead(path) || !in.identity(id)) {
         throw std::string("cannot open file for reading");
     }
 
     // get filesize
-    fstream.seekg(0, std::ios::end);
-    size_t actual = (size_t) fstream.tellg();
-    fstream.seekg(0, std::ios::beg);
+    long long actual = id.m_size;
 
     // if file fits in slice, just return the file
-    if (offset == 0 && size >= actual) {
+    if (offset == 0 && (size < 0 || size >= actual)) {
         return path;
     }
 
     // now check arguments
-    if (offset > actual) throw std::string("offset is beyond end of file");
-    if (size == (size_t) -1) size = actual - offset;
-    if (size > (actual - offset)) size = actual - offset;
+    if (offset < 0 || offset > actual) throw std::string("offset is beyond end of file");
+    if (size < 0 || size > (actual - offset)) size = actual - offset;
 
-    // check resource usage
-    if (m_limit.wouldExceed(1, size)) {
+    // unchanged since we last sliced it the same way?
+    collectTempFiles();
+    std::string key = cacheKey("slice", path, id, offset, size);
+    std::vector<ChunkInfo> cached;
+    if (findCached(key, cached)) {
+        bplus::service::Service::log(BP_DEBUG, "slice cached for " + path.string());
+        return cached[0].m_path;
+    }
+
+    // reserve resources
+    if (!m_limit.tryReserve(1, (size_t) size)) {
         throw std::string("allowed resources exceeded");
     }
 
     // create new output file
-    std::ofstream ofs;
+    NativeFile out;
     s = bp::file::getTempPath(m_tempDir, path.filename().string());
-    if (!bp::file::openWritableStream(ofs, s, std::ios_base::out
-                                      | std::ios_base::binary)) {
+    if (!out.openWrite(s)) {
+        m_limit.release(1, (size_t) size);
         throw std::string("unable to create new file");
     }
 
-    // seek to proper point in input stream
-    fstream.seekg(offset, std::ios::beg);
-
-    // update resources used
-    m_limit.noteUsage(1, size);
-    
-    while (size > 0) {
-        size_t amt = (size < BUFSIZE) ? size : BUFSIZE;
-        // read a chunk
-        fstream.read(buf, amt);
-        if (fstream.bad()) {
-            throw std::string("error reading file");
+    // let the kernel clone or copy as much as it can, then finish
+    // whatever is left with a buffered copy.
+    long long done = copyFileRange(in, offset, out, 0, size);
+    if (done < 0) {
+        done = 0;
+    }
+    if (done < size) {
+        char buf[BUFSIZE];
+        std::string err;
+        while (done < size) {
+            size_t amt = (size - done > BUFSIZE) ? BUFSIZE : (size_t) (size - done);
+            long long numRead = in.readAt(buf, amt, offset + done);
+            if (numRead < 0) {
+                err = "error reading file";
+                break;
+            }
+            if (numRead == 0) {
+                // file shrank since we sized it
+                break;
+            }
+            if (out.writeAt(buf, (size_t) numRead, done) != numRead) {
+                err = "error writing to new file";
+                break;
+            }
+            done += numRead;
+        }
+        if (!err.empty()) {
+            out.close();
+            bp::file::safeRemove(s);
+            m_limit.release(1, (size_t) size);
+            throw err;
         }
-        size_t numRead = (size_t) fstream.gcount();
-        ofs.write(buf, numRead);
-        if (ofs.bad()) throw std::string("error writing to new file");
-        
-        size -= numRead;
     }
-    
+
+    // track the slice so its usage can be reclaimed, and remember it
+    addTempFile(s, size);
+    ChunkInfo info = { s, 0, 1, 0, size };
+    cached.push_back(info);
+    storeCached(key, cached);
     return s;
 }
 
+void
+FileServer::addTempFile(const boost::filesystem::path& path, long long size) {
+    bplus::sync::Lock lck(m_tempLock);
+    TempFile& tf = m_tempFiles[path];
+    tf.m_size = size;
+    tf.m_created = (long long) time(NULL);
+    tf.m_refs = 1;
+    tf.m_order = m_tempOrder.insert(m_tempOrder.end(), path);
+}
+
+bool
+FileServer::releaseTempFile(const boost::filesystem::path& path) {
+    long long size = 0;
+    {
+        bplus::sync::Lock lck(m_tempLock);
+        std::map<boost::filesystem::path, TempFile>::iterator it = m_tempFiles.find(path);
+        if (it == m_tempFiles.end()) {
+            // only ever remove what we created
+            return false;
+        }
+        // others were handed the same file, it stays until they're done
+        if (it->second.m_refs > 1) {
+            it->second.m_refs--;
+            return true;
+        }
+        size = it->second.m_size;
+        m_tempOrder.erase(it->second.m_order);
+        m_tempFiles.erase(it);
+    }
+    m_handles.forget(path);
+    bp::file::safeRemove(path);
+    m_limit.release(1, (size_t) size);
+    return true;
+}
+
+void
+FileServer::collectTempFiles() {
+    long long now = (long long) time(NULL);
+    std::vector<boost::filesystem::path> expired;
+    size_t files = 0;
+    long long bytes = 0;
+    {
+        bplus::sync::Lock lck(m_tempLock);
+        while (!m_tempOrder.empty()) {
+            std::map<boost::filesystem::path, TempFile>::iterator it =
+                m_tempFiles.find(m_tempOrder.front());
+            if (now - it->second.m_created < FS_TEMP_MAX_AGE) {
+                break;
+            }
+            expired.push_back(it->first);
+            files++;
+            bytes += it->second.m_size;
+            m_tempFiles.erase(it);
+            m_tempOrder.pop_front();
+        }
+    }
+    // remove outside the lock, the files are already forgotten
+    for (size_t i = 0; i < expired.size(); i++) {
+        bplus::service::Service::log(BP_DEBUG, "reclaiming temp file " + expired[i].string());
+        m_handles.forget(expired[i]);
+        bp::file::safeRemove(expired[i]);
+    }
+    if (files) {
+        m_limit.release(files, (size_t) bytes);
+    }
+}
+
+std::string
+FileServer::cacheKey(const char* op, const boost::filesystem::path& path,
+                     const FileIdentity& id, long long a, long long b)
+{
+    std::stringstream ss;
+    ss << op << '|' << id.m_device << ':' << id.m_inode << '|' << id.m_size
+       << '|' << id.m_mtime << '.' << id.m_mtimeNsec << '|' << a << '|' << b << '|' << path.string();
+    return ss.str();
+}
+
+bool
+FileServer::findCached(const std::string& key, std::vector<ChunkInfo>& chunks) {
+    long long now = (long long) time(NULL);
+    bplus::sync::Lock lck(m_tempLock);
+    std::map<std::string, CachedResult>::iterator it = m_cache.find(key);
+    if (it == m_cache.end()) {
+        return false;
+    }
+    // every file must still be ours, and on disk.  if any was released
+    // or reclaimed the entry is stale.
+    const std::vector<ChunkInfo>& v = it->second.m_chunks;
+    for (size_t i = 0; i < v.size(); i++) {
+        if (m_tempFiles.find(v[i].m_path) == m_tempFiles.end()
+            || !boost::filesystem::exists(v[i].m_path))
+        {
+            m_cacheOrder.erase(it->second.m_order);
+            m_cache.erase(it);
+            return false;
+        }
+    }
+    // the files have another owner, and restart their clock
+    for (size_t i = 0; i < v.size(); i++) {
+        TempFile& tf = m_tempFiles[v[i].m_path];
+        tf.m_refs++;
+        tf.m_created = now;
+        m_tempOrder.splice(m_tempOrder.end(), m_tempOrder, tf.m_order);
+    }
+    m_cacheOrder.splice(m_cacheOrder.end(), m_cacheOrder, it->second.m_order);
+    chunks = v;
+    return true;
+}
+
+void
+FileServer::storeCached(const std::string& key, const std::vector<ChunkInfo>& chunks) {
+    bplus::sync::Lock lck(m_tempLock);
+    std::map<std::string, CachedResult>::iterator it = m_cache.find(key);
+    if (it != m_cache.end()) {
+        m_cacheOrder.erase(it->second.m_order);
+        m_cache.erase(it);
+    }
+    CachedResult& cr = m_cache[key];
+    cr.m_chunks = chunks;
+    cr.m_order = m_cacheOrder.insert(m_cacheOrder.end(), key);
+    // forget the least recently used results.  their files stay around
+    // (the page may still hold them) until released or reclaimed by age.
+    while (m_cache.size() > FS_MAX_CACHED_RESULTS) {
+        m_cache.erase(m_cacheOrder.front());
+        m_cacheOrder.pop_front();
+    }
+}
+
+// a connection is known by the client's address and port
+static unsigned long long
+connectionKey(const struct mg_request_info* info)
+{
+    return ((unsigned long long) (unsigned long) info->remote_ip << 16)
+        | (unsigned short) info->remote_port;
+}
+
+bool
+FileServer::keepConnection(struct mg_connection* conn, const struct mg_request_info* info)
+{
+    if (m_keepAliveMax == 0) {
+        return false;
+    }
+    // 1.1 clients persist unless they say otherwise, 1.0 ones only if asked
+    const char* connection = mg_get_header(conn, "Connection");
+    bool wanted;
+    if (info->http_version && strcmp(info->http_version, "1.1") == 0) {
+        wanted = connection == NULL || !boost::iequals(connection, "close");
+    } else {
+        wanted = connection != NULL && boost::iequals(connection, "keep-alive");
+    }
+    unsigned long long key = connectionKey(info);
+    long long now = (long long) time(NULL);
+    bplus::sync::Lock lck(m_connLock);
+    Connection& c = m_connections[key];
+    // quiet for longer than the idle timeout means the client has closed
+    // it, this is a new connection from the same port
+    if (c.m_requests == 0 || now - c.m_lastSeen > (long long) m_keepAliveIdle) {
+        c.m_requests = 0;
+    }
+    c.m_requests++;
+    c.m_lastSeen = now;
+    bool keep = wanted && c.m_requests < m_keepAliveMax;
+    if (!keep) {
+        m_connections.erase(key);
+    }
+    if (m_connections.size() > FS_MAX_TRACKED_CONNECTIONS) {
+        std::map<unsigned long long, Connection>::iterator it = m_connections.begin();
+        while (it != m_connections.end()) {
+            if (now - it->second.m_lastSeen > (long long) m_keepAliveIdle) {
+                m_connections.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return keep;
+}
+
+void
+FileServer::dropConnection(const struct mg_request_info* info)
+{
+    // mongoose has no call to close a connection, it reads another request
+    // on it unless the request's Connection header says close.  so make it
+    // say that: the client can't tell a cut short body from a complete one
+    // otherwise, and would wait on the rest of it
+    static char name[] = "Connection";
+    static char value[] = "close";
+    struct mg_request_info* ri = const_cast<struct mg_request_info*>(info);
+    const int capacity = (int) (sizeof(ri->http_headers) / sizeof(ri->http_headers[0]));
+    int i = 0;
+    while (i < ri->num_headers && !boost::iequals(ri->http_headers[i].name, name)) {
+        i++;
+    }
+    if (i == ri->num_headers) {
+        // the headers were all used up in handling the request
+        if (i == capacity) {
+            i--;
+        } else {
+            ri->num_headers++;
+        }
+        ri->http_headers[i].name = name;
+    }
+    ri->http_headers[i].value = value;
+    bplus::sync::Lock lck(m_connLock);
+    m_connections.erase(connectionKey(info));
+}
+
+void
+FileServer::sendConnectionHeaders(struct mg_connection* conn, bool keepAlive) const
+{
+    if (keepAlive) {
+        mg_printf(conn, "Connection: keep-alive\r\n");
+        mg_printf(conn, "Keep-Alive: timeout=%u, max=%u\r\n", m_keepAliveIdle, m_keepAliveMax);
+    } else {
+        mg_printf(conn, "Connection: close\r\n");
+    }
+}
+
+void
+FileServer::sendStatus(struct mg_connection* conn, Response& resp, int status, const char* reason)
+{
+    mg_printf(conn, "HTTP/1.1 %d %s\r\n", status, reason);
+    resp.m_status = status;
+    traceStage(resp, "status", status, 0);
+}
+
+void
+FileServer::traceStage(const Response& resp, const char* stage, int status, long long bytes)
+{
+    if (resp.m_traced && Trace::enabled(Trace::Stages)) {
+        Trace::record("http", stage, resp.m_hasToken ? &resp.m_token : NULL,
+                      status, bytes, metricsNow() - resp.m_start);
+    }
+}
+
+void
+FileServer::sendEmptyResponse(struct mg_connection* conn, Response& resp, int status,
+                              const char* reason, bool keepAlive) const
+{
+    sendStatus(conn, resp, status, reason);
+    if (status == 405) {
+        // a 405 has to say which methods would have worked
+        mg_printf(conn, "Allow: GET, HEAD\r\n");
+    }
+    mg_printf(conn, "Content-Length: 0\r\n");
+    sendConnectionHeaders(conn, keepAlive);
+    mg_printf(conn, "Server: FileAccess BrowserPlus service\r\n\r\n");
+}
+
+void
+FileServer::stats(MetricsSnapshot& s)
+{
+    m_metrics.snapshot(s);
+    s.m_tempFiles = (long long) m_limit.filesUsed();
+    s.m_tempBytes = (long long) m_limit.bytesUsed();
+    s.m_tempFileLimit = (long long) m_limit.fileLimit();
+    s.m_tempByteLimit = (long long) m_limit.byteLimit();
+    s.m_urls = (long long) m_tokens.size();
+    s.m_openHandles = (long long) m_handles.size();
+}
+
+void
+FileServer::sendStats(struct mg_connection* conn, Response& resp, bool keepAlive, bool head)
+{
+    MetricsSnapshot s;
+    stats(s);
+    std::string body = metricsJson(s);
+    sendStatus(conn, resp, 200, "OK");
+    mg_printf(conn, "Content-Type: application/json\r\n");
+    mg_printf(conn, "Content-Length: %lu\r\n", (unsigned long) body.size());
+    mg_printf(conn, "Cache-Control: no-store\r\n");
+    sendConnectionHeaders(conn, keepAlive);
+    mg_printf(conn, "Server: FileAccess BrowserPlus service\r\n\r\n");
+    if (!head && mg_write(conn, body.data(), body.size()) == (int) body.size()) {
+        resp.m_bytes += (long long) body.size();
+    }
+}
+
+bool
+FileServer::compressibleType(const std::string& mimeType)
+{
+    static const char* types[] = {
+        "application/json", "application/javascript", "application/x-javascript",
+        "application/xml", "application/csv", "application/x-sh", NULL
+    };
+    std::string t = boost::to_lower_copy(mimeType.substr(0, mimeType.find(';')));
+    if (boost::starts_with(t, "text/") || boost::ends_with(t, "+xml")
+        || boost::ends_with(t, "+json"))
+    {
+        return true;
+    }
+    for (size_t i = 0; types[i]; i++) {
+        if (t == types[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+FileServer::acceptedEncoding(const char* header, Deflater::Format& format)
+{
+    bool gzip = false, deflate = false, any = false;
+    bool gzipNamed = false, deflateNamed = false;
+    std::vector<std::string> codings;
+    boost::split(codings, header, boost::is_any_of(","));
+    for (size_t i = 0; i < codings.size(); i++) {
+        // "name" or "name;q=0.5", a q of 0 means not acceptable
+        std::string c = boost::to_lower_copy(codings[i]);
+        size_t semi = c.find(';');
+        std::string name = boost::trim_copy(c.substr(0, semi));
+        bool ok = true;
+        if (semi != std::string::npos) {
+            std::string param = boost::trim_copy(c.substr(semi + 1));
+            if (boost::starts_with(param, "q=")) {
+                ok = atof(param.c_str() + 2) > 0;
+            }
+        }
+        if (name == "gzip" || name == "x-gzip") {
+            gzip = ok;
+            gzipNamed = true;
+        } else if (name == "deflate") {
+            deflate = ok;
+            deflateNamed = true;
+        } else if (name == "*") {
+            any = ok;
+        }
+    }
+    // * only speaks for the codings that aren't named
+    if (!gzipNamed) gzip = any;
+    if (!deflateNamed) deflate = any;
+    if (gzip) {
+        format = Deflater::Gzip;
+        return true;
+    }
+    if (deflate) {
+        format = Deflater::Zlib;
+        return true;
+    }
+    return false;
+}
+
+// write data to conn as the next piece of the body, as a chunk if the
+// response is chunked
+static bool
+sendBody(struct mg_connection* conn, const std::string& data, bool chunked)
+{
+    if (data.empty()) {
+        return true;
+    }
+    if (chunked && mg_printf(conn, "%lx\r\n", (unsigned long) data.size()) <= 0) {
+        return false;
+    }
+    if (mg_write(conn, data.data(), data.size()) != (int) data.size()) {
+        return false;
+    }
+    return !chunked || mg_write(conn, "\r\n", 2) == 2;
+}
+
+void
+FileServer::sendCompressed(struct mg_connection* conn, const struct mg_request_info* info,
+                           const NativeFile& file, const FileIdentity& version,
+                           long long base, long long len, Deflater::Format format,
+                           const std::string& headers, bool keepAlive, bool head,
+                           Response& resp)
+{
+    const char* encoding = format == Deflater::Gzip ? "gzip" : "deflate";
+    // serve a variant compressed earlier if there is one
+    boost::filesystem::path variant;
+    if (m_compressCache) {
+        std::stringstream ss;
+        ss << "variant-" << encoding << '-' << std::hex << version.m_device << '-'
+           << version.m_inode << '-' << version.m_size << '-' << version.m_mtime
+           << '.' << version.m_mtimeNsec << '-' << base << '-' << len;
+        variant = m_tempDir / ss.str();
+        NativeFile cached;
+        long long size;
+        if (cached.openRead(variant) && (size = cached.size()) >= 0) {
+            sendStatus(conn, resp, 200, "OK");
+            mg_printf(conn, "Content-Encoding: %s\r\n", encoding);
+            mg_printf(conn, "Content-Length: %lld\r\n", size);
+            sendConnectionHeaders(conn, keepAlive);
+            mg_printf(conn, "%s\r\n", headers.c_str());
+            if (!head && !sendFileRange(conn, cached, 0, size, resp)) {
+                bplus::service::Service::log(BP_WARN, "partial write detected!  client left?");
+                dropConnection(info);
+            }
+            return;
+        }
+    }
+    // otherwise compress as we go.  the length isn't known up front, so
+    // the body is chunked, or for 1.0 clients ends when the connection does
+    bool chunked = info->http_version && strcmp(info->http_version, "1.1") == 0;
+    keepAlive = keepAlive && chunked;
+    if (!chunked) {
+        // the close is what ends the body, mongoose would otherwise keep
+        // a 1.0 keep-alive connection open and the client would wait on it
+        dropConnection(info);
+    }
+    sendStatus(conn, resp, 200, "OK");
+    mg_printf(conn, "Content-Encoding: %s\r\n", encoding);
+    if (chunked) {
+        mg_printf(conn, "Transfer-Encoding: chunked\r\n");
+    }
+    sendConnectionHeaders(conn, keepAlive);
+    mg_printf(conn, "%s\r\n", headers.c_str());
+    if (head) {
+        return;
+    }
+    NativeFile out;
+    boost::filesystem::path tmp;
+    bool caching = false;
+    if (!variant.empty()) {
+        tmp = bp::file::getTempPath(m_tempDir, "variant");
+        caching = out.openWrite(tmp);
+    }
+    Deflater deflater(format);
+    std::vector<char> buf(m_ioBuffer);
+    std::string z;
+    long long done = 0, written = 0;
+    bool ok = true;
+    while (ok && done <= len) {
+        if (done < len) {
+            size_t want = buf.size();
+            if ((long long) want > len - done) want = (size_t) (len - done);
+            long long rd = file.readAt(&buf[0], want, base + done);
+            if (rd <= 0) {
+                bplus::service::Service::log(BP_WARN, "read error while compressing");
+                ok = false;
+                break;
+            }
+            deflater.write(&buf[0], (size_t) rd, z);
+            done += rd;
+        } else {
+            deflater.finish(z);
+            done++;
+        }
+        if (!sendBody(conn, z, chunked)) {
+            bplus::service::Service::log(BP_WARN, "partial write detected!  client left?");
+            ok = false;
+        } else {
+            resp.m_bytes += (long long) z.size();
+        }
+        if (caching && out.writeAt(z.data(), z.size(), written) != (long long) z.size()) {
+            caching = false;
+        }
+        written += (long long) z.size();
+        z.clear();
+    }
+    if (ok && chunked) {
+        mg_printf(conn, "0\r\n\r\n");
+    } else if (!ok) {
+        // without the last chunk the body is incomplete, but only closing
+        // the connection tells the client so
+        dropConnection(info);
+    }
+    out.close();
+    if (ok && caching) {
+        adoptVariant(tmp, variant, written);
+    } else if (!tmp.empty()) {
+        bp::file::safeRemove(tmp);
+    }
+}
+
+void
+FileServer::adoptVariant(const boost::filesystem::path& tmp,
+                         const boost::filesystem::path& variant, long long size)
+{
+    if (m_limit.tryReserve(1, size)) {
+        bplus::sync::Lock lck(m_tempLock);
+        if (m_tempFiles.find(variant) == m_tempFiles.end()) {
+            try {
+                boost::filesystem::rename(tmp, variant);
+                TempFile& tf = m_tempFiles[variant];
+                tf.m_size = size;
+                tf.m_created = (long long) time(NULL);
+                tf.m_refs = 1;
+                tf.m_order = m_tempOrder.insert(m_tempOrder.end(), variant);
+                return;
+            } catch (const boost::filesystem::filesystem_error&) {
+            }
+        }
+        m_limit.release(1, size);
+    }
+    bp::file::safeRemove(tmp);
+}
+
+static const char* s_dayNames[] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+static const char* s_monthNames[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+// days since 1970-01-01 of a proleptic gregorian date, and the reverse
+// (H. Hinnant's algorithms), so we needn't depend on timegm/gmtime_r
+static long long
+daysFromCivil(long long y, int m, int d)
+{
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void
+civilFromDays(long long z, long long& y, int& m, int& d)
+{
+    z += 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    long long doe = z - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    d = (int) (doy - (153 * mp + 2) / 5 + 1);
+    m = (int) (mp < 10 ? mp + 3 : mp - 9);
+    y = yoe + era * 400 + (m <= 2);
+}
+
+std::string
+FileServer::entityTag(const FileIdentity& id, long long base, long long len)
+{
+    std::stringstream ss;
+    ss << '"' << std::hex << id.m_inode << '-' << id.m_size << '-' << id.m_mtime
+       << '.' << id.m_mtimeNsec;
+    // distinct views of the same file are distinct entities
+    if (base != 0 || len != id.m_size) {
+        ss << '-' << base << '-' << len;
+    }
+    ss << '"';
+    return ss.str();
+}
+
+bool
+FileServer::entityTagMatches(const char* header, const std::string& etag)
+{
+    std::string list(header);
+    size_t pos = 0;
+    while (pos < list.length()) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = list.length();
+        }
+        std::string tag = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t b = tag.find_first_not_of(" \t");
+        if (b == std::string::npos) {
+            continue;
+        }
+        size_t e = tag.find_last_not_of(" \t");
+        tag = tag.substr(b, e - b + 1);
+        if (tag == "*") {
+            return true;
+        }
+        if (tag.compare(0, 2, "W/") == 0) {
+            tag = tag.substr(2);
+        }
+        if (tag == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string
+FileServer::httpDate(long long t)
+{
+    long long days = t / 86400, secs = t % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        days--;
+    }
+    long long y;
+    int m, d;
+    civilFromDays(days, y, m, d);
+    // 1970-01-01 was a thursday
+    int wday = (int) (((days % 7) + 11) % 7);
+    std::stringstream ss;
+    ss << s_dayNames[wday] << ", " << std::setfill('0') << std::setw(2) << d
+       << ' ' << s_monthNames[m - 1] << ' ' << std::setw(4) << y << ' '
+       << std::setw(2) << secs / 3600 << ':' << std::setw(2) << (secs / 60) % 60
+       << ':' << std::setw(2) << secs % 60 << " GMT";
+    return ss.str();
+}
+
+bool
+FileServer::parseHttpDate(const char* s, long long& t)
+{
+    char mon[4] = { 0 };
+    int d = 0, y = 0, hh = 0, mm = 0, ss = 0;
+    // "Sun, 06 Nov 1994 08:49:37 GMT", "Sunday, 06-Nov-94 08:49:37 GMT"
+    // or "Sun Nov  6 08:49:37 1994"
+    if (sscanf(s, "%*[a-zA-Z], %d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6
+        && sscanf(s, "%*[a-zA-Z], %d-%3s-%d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6
+        && sscanf(s, "%*[a-zA-Z] %3s %d %d:%d:%d %d", mon, &d, &hh, &mm, &ss, &y) != 6)
+    {
+        return false;
+    }
+    int m = 0;
+    while (m < 12 && strcmp(mon, s_monthNames[m]) != 0) {
+        m++;
+    }
+    if (m == 12 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60) {
+        return false;
+    }
+    if (y < 100) {
+        // two digit years, RFC 2616 19.3
+        y += y < 70 ? 2000 : 1900;
+    }
+    t = daysFromCivil(y, m + 1, d) * 86400 + hh * 3600 + mm * 60 + ss;
+    return true;
+}
+
+FileServer::RangeResult
+FileServer::parseByteRange(const char* header, long long len,
+                           long long& first, long long& last)
+{
+    // we support a single range of the form "bytes=a-b", "bytes=a-" or
+    // "bytes=-n".  anything else (including multiple ranges) is ignored
+    // and the full entity is returned, as permitted by RFC 2616 14.35.
+    std::string spec(header);
+    const std::string unit("bytes=");
+    size_t start = spec.find_first_not_of(" \t");
+    if (start == std::string::npos || spec.compare(start, unit.length(), unit) != 0) {
+        return RangeIgnored;
+    }
+    spec = spec.substr(start + unit.length());
+    if (spec.find(',') != std::string::npos) {
+        return RangeIgnored;
+    }
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return RangeIgnored;
+    }
+    std::string lhs = spec.substr(0, dash);
+    std::string rhs = spec.substr(dash + 1);
+    lhs.erase(0, lhs.find_first_not_of(" \t"));
+    rhs.erase(rhs.find_last_not_of(" \t\r\n") + 1);
+    if (lhs.find_first_not_of("0123456789") != std::string::npos
+        || rhs.find_first_not_of("0123456789") != std::string::npos
+        || (lhs.empty() && rhs.empty()))
+    {
+        return RangeIgnored;
+    }
+    if (lhs.empty()) {
+        // suffix range, the last n bytes
+        long long n = strtoll(rhs.c_str(), NULL, 10);
+        if (n <= 0 || len == 0) {
+            return RangeNotSatisfiable;
+        }
+        first = (n >= len) ? 0 : len - n;
+        last = len - 1;
+        return RangeSatisfiable;
+    }
+    first = strtoll(lhs.c_str(), NULL, 10);
+    last = rhs.empty() ? len - 1 : strtoll(rhs.c_str(), NULL, 10);
+    if (last < first) {
+        return RangeIgnored;
+    }
+    if (first >= len) {
+        return RangeNotSatisfiable;
+    }
+    if (last >= len) {
+        last = len - 1;
+    }
+    return RangeSatisfiable;
+}
+
+bool
+FileServer::sendFileRange(struct mg_connection* conn, const NativeFile& file,
+                          long long offset, long long count, Response& resp)
+{
+    // positional reads through a buffer rather than a mapping: the file
+    // is the user's and may be truncated by another process while we
+    // send it, which a read reports but a mapped page answers with
+    // SIGBUS.  there's no zero-copy path either way: mongoose only takes
+    // bytes from memory through mg_write, it has no sendfile.  small
+    // ranges get a buffer of their own size.
+    std::vector<char> buf((count < (long long) m_sendWindow) ? (size_t) count : m_sendWindow);
+    while (count > 0) {
+        size_t want = (count < (long long) buf.size()) ? (size_t) count : buf.size();
+        long long rd = file.readAt(&buf[0], want, offset);
+        if (rd <= 0) {
+            // file shrank underneath us, nothing more we can send
+            return false;
+        }
+        if (rd != (long long) mg_write(conn, &buf[0], (size_t) rd)) {
+            return false;
+        }
+        resp.m_bytes += rd;
+        offset += rd;
+        count -= rd;
+    }
+    return true;
+}
+
 void*
 FileServer::mongooseCallback(enum mg_event event, struct mg_connection *conn, const struct mg_request_info *request_info) {
     if (event != MG_NEW_REQUEST) {
@@ -245,8 +1327,45 @@ FileServer::mongooseCallback(enum mg_event event, struct mg_connection *conn, co
     if (FileServer::s_self == NULL) {
         return NULL;
     }
+    FileServer* self = FileServer::s_self;
+    Response resp;
+    resp.m_status = 0;
+    resp.m_bytes = 0;
+    resp.m_start = metricsNow();
+    resp.m_traced = Trace::sample();
+    resp.m_hasToken = false;
+    bool keepAlive = self->keepConnection(conn, request_info);
+    if (!keepAlive) {
+        // mongoose only goes by the request's Connection header, without
+        // this a client that ignores our close could go on using it
+        self->dropConnection(request_info);
+    }
+    // only GET and HEAD, there's no request body to skip over
+    bool head = strcmp(request_info->request_method, "HEAD") == 0;
+    if (!head && strcmp(request_info->request_method, "GET") != 0) {
+        self->sendEmptyResponse(conn, resp, 405, "Method Not Allowed", false);
+        if (keepAlive) {
+            self->dropConnection(request_info);
+        }
+    } else if (strcmp(request_info->uri, FS_STATS_PATH) == 0) {
+        self->sendStats(conn, resp, keepAlive, head);
+    } else {
+        self->serveRequest(conn, request_info, keepAlive, head, resp);
+    }
+    long long elapsed = metricsNow() - resp.m_start;
+    self->m_metrics.recordRequest(resp.m_status, resp.m_bytes, elapsed);
+    if (resp.m_traced) {
+        Trace::record("http", "done", resp.m_hasToken ? &resp.m_token : NULL,
+                      resp.m_status, resp.m_bytes, elapsed);
+    }
+    return conn;
+}
+
+void
+FileServer::serveRequest(struct mg_connection* conn, const struct mg_request_info* request_info,
+                         bool keepAlive, bool head, Response& resp)
+{
     std::string id(request_info->uri);
-    bplus::service::Service::log(BP_INFO, "request.url.path = " + id);
     // drop the leading /
     id = id.substr(1, id.length() - 1);
     // if we can find a slash '/', in the url, we'll drop everything after it.
@@ -254,63 +1373,143 @@ FileServer::mongooseCallback(enum mg_event event, struct mg_connection *conn, co
     if (slashLoc != std::string::npos) {
         id = id.substr(0, slashLoc);
     }
-    bplus::service::Service::log(BP_INFO, "token '" + id + "' extracted from request path: " + request_info->uri);
-    boost::filesystem::path path;
-    {
-        bplus::sync::Lock lck(FileServer::s_self->m_lock);
-        std::map<std::string,boost::filesystem::path>::const_iterator it;
-        it = FileServer::s_self->m_paths.find(id);
-        if (it == FileServer::s_self->m_paths.end()) {
-            bplus::service::Service::log(BP_WARN, "Requested id not found.");
-            mg_printf(conn, "HTTP/1.0 404 Not Found\r\n\r\n");
-            return conn;
-        }
-        path = it->second;
-    }
-    // read file and output to connection
-    std::ifstream ifs;
-    if (!bp::file::openReadableStream(ifs, path.string(), std::ios::binary)) {
-        bplus::service::Service::log(BP_WARN, "Couldn't open file for reading " + path.string());
-        mg_printf(conn, "HTTP/1.0 500 Internal Error\r\n\r\n");
-        return conn;
+    ServedFile served;
+    Token token;
+    if (Token::parse(id, token)) {
+        resp.m_token = token;
+        resp.m_hasToken = true;
     }
-    // get length of file:
-    long len = 0;
-    try {
-        ifs.seekg(0, std::ios::end);
-        len = ifs.tellg();
-        ifs.seekg(0, std::ios::beg);
-    } catch (...) {
-        len = -1;
+    if (!resp.m_hasToken || !m_tokens.find(token, served)) {
+        bplus::service::Service::log(BP_WARN, "Requested id not found.");
+        sendEmptyResponse(conn, resp, 404, "Not Found", keepAlive);
+        return;
     }
+    const boost::filesystem::path& path = served.m_path;
+    // open file (or reuse the handle from an earlier request) and output
+    // to connection
+    FileIdentity version;
+    boost::shared_ptr<NativeFile> handle = m_handles.open(path, version);
+    if (!handle) {
+        bplus::service::Service::log(BP_WARN, "Couldn't open file for reading " + path.string());
+        sendEmptyResponse(conn, resp, 500, "Internal Error", keepAlive);
+        return;
+    }
+    const NativeFile& file = *handle;
+    long long len = version.m_size;
+    traceStage(resp, "open", 0, len);
     if (len < 0) {
         bplus::service::Service::log(BP_WARN, "Couldn't determine file length: " + path.string());
-        mg_printf(conn, "HTTP/1.0 500 Internal Error\r\n\r\n");
-        return conn;
+        sendEmptyResponse(conn, resp, 500, "Internal Error", keepAlive);
+        return;
+    }
+    // the entity served is the registered view onto the file
+    long long base = served.m_offset;
+    if (base > len) {
+        base = len;
     }
-    mg_printf(conn, "HTTP/1.0 200 OK\r\n");
-    mg_printf(conn, "Content-Length: %ld\r\n", len);
-    mg_printf(conn, "Server: FileAccess BrowserPlus service\r\n");
-    // set mime type header
+    len -= base;
+    if (served.m_size >= 0 && served.m_size < len) {
+        len = served.m_size;
+    }
+    const std::string& mimeType = served.m_mimeType;
+    // text goes out compressed to clients that accept it, unless they
+    // want part of it.  the compressed variant is an entity of its own.
+    bool varies = m_compress && compressibleType(mimeType);
+    bool compress = false;
+    Deflater::Format format = Deflater::Gzip;
+    if (varies && len >= FS_COMPRESS_MIN_SIZE && mg_get_header(conn, "Range") == NULL) {
+        const char* acceptEncoding = mg_get_header(conn, "Accept-Encoding");
+        compress = acceptEncoding != NULL && acceptedEncoding(acceptEncoding, format);
+    }
+    std::string etag = entityTag(version, base, len);
+    if (compress) {
+        etag.insert(etag.length() - 1, format == Deflater::Gzip ? "-gzip" : "-deflate");
+    }
+    // headers every response for the entity carries
+    std::string lastModified = httpDate(version.m_mtime);
+    std::string headers;
     {
-        std::vector<std::string> mts;
-        mts = bp::file::mimeTypes(path);
-        if (mts.size() > 0) {
-            mg_printf(conn, "Content-Type: %s\r\n", mts.begin()->c_str());
-        }
-    }
-    mg_printf(conn, "\r\n");    
-    char buf[1024 * 32];
-    while (!ifs.eof()) {
-        size_t rd = 0;
-        ifs.read(buf, sizeof(buf));
-        rd = ifs.gcount();
-        if (rd != (size_t) mg_write(conn, buf, rd)) {
-            bplus::service::Service::log(BP_WARN, "partial write detected!  client left?");
-            ifs.close();
-            return conn;
+        std::stringstream ss;
+        ss << "ETag: " << etag << "\r\n"
+           << "Last-Modified: " << lastModified << "\r\n"
+           << "Cache-Control: " << FS_CACHE_CONTROL << "\r\n";
+        if (varies) {
+            ss << "Vary: Accept-Encoding\r\n";
+        }
+        ss << "Server: FileAccess BrowserPlus service\r\n";
+        if (!mimeType.empty()) {
+            ss << "Content-Type: " << mimeType << "\r\n";
         }
+        headers = ss.str();
+    }
+    // let the browser reuse what it has if it's still current.  an etag
+    // trumps a date, RFC 2616 14.26
+    const char* ifNoneMatch = mg_get_header(conn, "If-None-Match");
+    const char* ifModifiedSince = mg_get_header(conn, "If-Modified-Since");
+    bool notModified = false;
+    long long since = 0;
+    if (ifNoneMatch != NULL) {
+        notModified = entityTagMatches(ifNoneMatch, etag);
+    } else if (ifModifiedSince != NULL && parseHttpDate(ifModifiedSince, since)) {
+        notModified = version.m_mtime <= since;
+    }
+    if (notModified) {
+        sendStatus(conn, resp, 304, "Not Modified");
+        sendConnectionHeaders(conn, keepAlive);
+        mg_printf(conn, "%s\r\n", headers.c_str());
+        return;
+    }
+    if (compress) {
+        sendCompressed(conn, request_info, file, version, base, len, format,
+                       headers, keepAlive, head, resp);
+        return;
+    }
+    // honor a single byte range if the client asked for one, and (given
+    // If-Range) still has the same version of the rest
+    long long first = 0, last = len - 1;
+    bool partial = false;
+    const char* range = mg_get_header(conn, "Range");
+    const char* ifRange = mg_get_header(conn, "If-Range");
+    if (range != NULL && ifRange != NULL) {
+        long long when = 0;
+        bool current = (ifRange[0] == '"') ? etag == ifRange
+            : (parseHttpDate(ifRange, when) && when == version.m_mtime);
+        if (!current) {
+            range = NULL;
+        }
+    }
+    if (range != NULL) {
+        switch (parseByteRange(range, len, first, last)) {
+            case RangeSatisfiable:
+                partial = true;
+                break;
+            case RangeNotSatisfiable:
+                bplus::service::Service::log(BP_WARN, std::string("Unsatisfiable range: ") + range);
+                sendStatus(conn, resp, 416, "Requested Range Not Satisfiable");
+                mg_printf(conn, "Content-Range: bytes */%lld\r\n", len);
+                mg_printf(conn, "Content-Length: 0\r\n");
+                sendConnectionHeaders(conn, keepAlive);
+                mg_printf(conn, "\r\n");
+                return;
+            case RangeIgnored:
+                first = 0;
+                last = len - 1;
+                break;
+        }
+    }
+    long long count = last - first + 1;
+    if (partial) {
+        sendStatus(conn, resp, 206, "Partial Content");
+        mg_printf(conn, "Content-Range: bytes %lld-%lld/%lld\r\n", first, last, len);
+    } else {
+        sendStatus(conn, resp, 200, "OK");
+    }
+    mg_printf(conn, "Content-Length: %lld\r\n", count);
+    mg_printf(conn, "Accept-Ranges: bytes\r\n");
+    sendConnectionHeaders(conn, keepAlive);
+    mg_printf(conn, "%s\r\n", headers.c_str());
+    if (!head && !sendFileRange(conn, file, base + first, count, resp)) {
+        bplus::service::Service::log(BP_WARN, "partial write detected!  client left?");
+        dropConnection(request_info);
     }
-    bplus::service::Service::log(BP_DEBUG, "Request processed.");
-    return conn;
 }
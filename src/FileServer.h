@@ -11,9 +11,16 @@
 #include "bp-file/bpfile.h"
 #include "bputil/bpsync.h"
 #include "ResourceLimit.h"
+#include "FileIO.h"
+#include "TokenTable.h"
+#include "HandleCache.h"
+#include "Deflate.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <mongoose/mongoose.h>
 #include <string>
 #include <vector>
+#include <list>
 #include <map>
 
 class ChunkInfo {
@@ -21,6 +28,22 @@ public:
     boost::filesystem::path m_path;
     size_t m_chunkNumber;
     size_t m_numberOfChunks;
+    /* byte range of m_path covered by this chunk.  for copied chunks this
+     * is the whole of m_path, for virtual chunks it's a view onto the
+     * source file */
+    long long m_offset;
+    long long m_size;
+    /* digest name -> hex, for the digests that were asked for */
+    std::map<std::string, std::string> m_digests;
+};
+
+/* receives chunks from getFileChunks/getVirtualChunks as each becomes
+ * available, possibly out of order.  calls may come from any thread but
+ * never overlap. */
+class ChunkListener {
+public:
+    virtual ~ChunkListener() {}
+    virtual void chunkReady(const ChunkInfo& chunk) = 0;
 };
 
 class FileServer {
@@ -30,23 +53,214 @@ public:
     /* start the server, returns host/port when bound, otherwise returns
      * .empty() on error */     
     std::string start();
-    /* add a file to the server, returning a url, .empty() on error */ 
-    std::string addFile(const boost::filesystem::path& path);
+    /* persistent connections.  a connection is closed after maxRequests
+     * requests, and clients are told to close it after idleTimeout idle
+     * seconds.  maxRequests of 0 turns keep-alive off.  must be called
+     * before start() */
+    void setKeepAlive(unsigned int idleTimeout, unsigned int maxRequests);
+    unsigned int keepAliveTimeout() const { return m_keepAliveIdle; }
+    unsigned int keepAliveRequests() const { return m_keepAliveMax; }
+    /* compress text responses for clients that accept gzip or deflate.
+     * with cache set, compressed variants are kept in the temp dir for
+     * reuse until the file changes (or they age out) */
+    void setCompression(bool enabled, bool cache);
+    /* the number of threads serving http requests, 0 for the server's
+     * default.  must be called before start() */
+    void setThreads(unsigned int threads);
+    /* most bytes of a file read and handed to the connection at once
+     * when serving it, and the size of the buffer used for compression.
+     * 0 leaves a size as is */
+    void setSendSizes(size_t sendWindow, size_t ioBuffer);
+    /* the most chunk, slice and compressed files, and bytes in them, kept
+     * in the temp dir at once.  must be called before the server is used */
+    void setTempLimits(size_t files, size_t bytes);
+    /* add a file to the server, returning a url, .empty() on error.
+     * offset and size restrict the url to a byte range of the file,
+     * size < 0 means through the end of file.  the url stops working
+     * after idleTimeout seconds without a request or lifetime seconds
+     * in total, < 0 selects the server defaults and 0 means never */ 
+    std::string addFile(const boost::filesystem::path& path,
+                        long long offset = 0, long long size = -1,
+                        long idleTimeout = -1, long lifetime = -1);
+    /* stop serving a url returned by addFile, false if it's unknown */
+    bool removeFile(const std::string& url);
     /* add a chunked file to the server, returning a vector of 
-     * ChunkInfo (empty on error)
+     * ChunkInfo (empty on error).  if listener is given it's handed
+     * each chunk as soon as it has been written.  on error, chunks it
+     * has already seen are removed along with the rest.  digests is a
+     * mask of Digest::Algorithm, computed per chunk in the same pass
+     * that writes it.
      */
-    std::vector<ChunkInfo> getFileChunks(const boost::filesystem::path& path, size_t chunkSize);
-    /* get a slice of a file */
-    boost::filesystem::path getSlice(const boost::filesystem::path& path, size_t offset, size_t size);
+    std::vector<ChunkInfo> getFileChunks(const boost::filesystem::path& path, size_t chunkSize,
+                                         ChunkListener* listener = NULL,
+                                         unsigned int digests = 0);
+    /* chunk a file without copying it.  each returned ChunkInfo refers
+     * to the source file, with m_offset/m_size describing the chunk.
+     * asking for digests means reading the file, nothing is written */
+    std::vector<ChunkInfo> getVirtualChunks(const boost::filesystem::path& path, size_t chunkSize,
+                                            ChunkListener* listener = NULL,
+                                            unsigned int digests = 0);
+    /* chunk a file at content defined boundaries, so that chunks of
+     * unchanged regions come out the same even when data is inserted or
+     * removed elsewhere.  chunks are between minSize and maxSize bytes,
+     * averaging about avgSize.  if copy is set each chunk is written to a
+     * file of its own, as getFileChunks, otherwise the chunks are views
+     * onto the source, as getVirtualChunks.  a sha256 digest is computed
+     * if no digests are asked for. */
+    std::vector<ChunkInfo> getContentChunks(const boost::filesystem::path& path,
+                                            size_t minSize, size_t avgSize, size_t maxSize,
+                                            bool copy, ChunkListener* listener = NULL,
+                                            unsigned int digests = 0);
+    /* digests (a mask of Digest::Algorithm) of size bytes of a file at
+     * offset, size < 0 means through the end of file.  digest name -> hex */
+    std::map<std::string, std::string> getDigests(const boost::filesystem::path& path,
+                                                  long long offset, long long size,
+                                                  unsigned int digests);
+    /* get a slice of a file, size < 0 means through the end of file */
+    boost::filesystem::path getSlice(const boost::filesystem::path& path,
+                                     long long offset, long long size);
+    /* give up a chunk or slice file created by this server.  a cached
+     * result hands the same files to every caller that asks for it, so a
+     * file is only deleted and its resources reclaimed once each of them
+     * has released it.  false if path isn't one of ours.  files are also
+     * reclaimed automatically once they reach a maximum age */
+    bool releaseTempFile(const boost::filesystem::path& path);
+    /* per method and per request counters, also served as JSON at
+     * /__stats on the server */
+    Metrics& metrics() { return m_metrics; }
+    /* the metrics along with temp storage use and table sizes */
+    void stats(MetricsSnapshot& s);
 private:
+    /* a chunk or slice file we've created.  m_refs is the number of
+     * callers it's been handed to and not yet released by */
+    struct TempFile {
+        long long m_size;
+        long long m_created;
+        unsigned int m_refs;
+        std::list<boost::filesystem::path>::iterator m_order;
+    };
+    void addTempFile(const boost::filesystem::path& path, long long size);
+    /* write each (offset, length) range of file to a chunk file of its
+     * own, recording the result in the cache under key */
+    std::vector<ChunkInfo> writeChunks(const boost::filesystem::path& path, const NativeFile& file,
+                                       const std::vector<std::pair<long long, long long> >& bounds,
+                                       const std::string& key, ChunkListener* listener,
+                                       unsigned int digests);
+    /* reclaim temp files that have reached their maximum age */
+    void collectTempFiles();
+    /* previously materialized chunks/slices, keyed by the operation, its
+     * arguments and the identity of the source file */
+    struct CachedResult {
+        std::vector<ChunkInfo> m_chunks;
+        std::list<std::string>::iterator m_order;
+    };
+    static std::string cacheKey(const char* op, const boost::filesystem::path& path,
+                                const FileIdentity& id, long long a, long long b);
+    /* false if there's no entry, or its files have since been released */
+    bool findCached(const std::string& key, std::vector<ChunkInfo>& chunks);
+    void storeCached(const std::string& key, const std::vector<ChunkInfo>& chunks);
+    enum RangeResult {
+        RangeIgnored,
+        RangeSatisfiable,
+        RangeNotSatisfiable
+    };
+    /* parse the value of a Range: header against an entity of len bytes.
+     * on RangeSatisfiable, first and last hold the inclusive byte range */
+    static RangeResult parseByteRange(const char* header, long long len,
+                                      long long& first, long long& last);
+    /* validator for the bytes [base, base+len) of a particular version
+     * of a file, quoted, for ETag: */
+    static std::string entityTag(const FileIdentity& id, long long base, long long len);
+    /* true if etag is one of those listed in an If-None-Match: header,
+     * or the header is "*".  weak comparison, per RFC 2616 13.3.3 */
+    static bool entityTagMatches(const char* header, const std::string& etag);
+    /* seconds since the epoch as an RFC 1123 date, and back.  parsing
+     * also accepts the obsolete RFC 850 and asctime() forms */
+    static std::string httpDate(long long t);
+    static bool parseHttpDate(const char* s, long long& t);
+    /* count a request against its connection (known by the client's
+     * address and port), true if the connection may stay open after the
+     * response.  if not, the caller has to dropConnection() it */
+    bool keepConnection(struct mg_connection* conn, const struct mg_request_info* info);
+    /* close the connection once the response is done, whatever it was
+     * promised, for when the body couldn't be sent in full */
+    void dropConnection(const struct mg_request_info* info);
+    /* what went back for a request, for the metrics and the trace */
+    struct Response {
+        int m_status;
+        long long m_bytes;
+        long long m_start;
+        bool m_traced;
+        bool m_hasToken;
+        Token m_token;
+    };
+    /* a step along the way of a traced request */
+    static void traceStage(const Response& resp, const char* stage, int status, long long bytes);
+    /* the status line */
+    static void sendStatus(struct mg_connection* conn, Response& resp,
+                           int status, const char* reason);
+    /* Connection: (and Keep-Alive:) response headers */
+    void sendConnectionHeaders(struct mg_connection* conn, bool keepAlive) const;
+    /* a complete response with no body, with Allow: for a 405 */
+    void sendEmptyResponse(struct mg_connection* conn, Response& resp, int status,
+                           const char* reason, bool keepAlive) const;
+    /* the metrics as JSON, for /__stats */
+    void sendStats(struct mg_connection* conn, Response& resp, bool keepAlive, bool head);
+    /* worth compressing, by mime type */
+    static bool compressibleType(const std::string& mimeType);
+    /* the encoding to use given an Accept-Encoding: header, gzip
+     * preferred.  false if neither gzip nor deflate is acceptable */
+    static bool acceptedEncoding(const char* header, Deflater::Format& format);
+    /* send len bytes of file at base compressed, from the variant cache
+     * if it's there, otherwise compressing as we go (and filling the
+     * cache).  headers are those common to all responses for the file */
+    void sendCompressed(struct mg_connection* conn, const struct mg_request_info* info,
+                        const NativeFile& file, const FileIdentity& version,
+                        long long base, long long len, Deflater::Format format,
+                        const std::string& headers, bool keepAlive, bool head,
+                        Response& resp);
+    /* move a freshly written compressed variant into place and track it
+     * like a temp file, or discard it if another request got there first
+     * or there's no room */
+    void adoptVariant(const boost::filesystem::path& tmp,
+                      const boost::filesystem::path& variant, long long size);
+    /* write count bytes of file starting at offset to conn, false if the
+     * client went away or the file couldn't be read */
+    bool sendFileRange(struct mg_connection* conn, const NativeFile& file,
+                       long long offset, long long count, Response& resp);
+    /* answer one GET or HEAD */
+    void serveRequest(struct mg_connection* conn, const struct mg_request_info* info,
+                      bool keepAlive, bool head, Response& resp);
     static void* mongooseCallback(enum mg_event event, struct mg_connection *conn, const struct mg_request_info *request_info);
 private:
     unsigned short int m_port;
-    std::map<std::string, boost::filesystem::path> m_paths;
+    TokenTable m_tokens;
+    HandleCache m_handles;
     boost::filesystem::path m_tempDir;
     ResourceLimit m_limit;
+    std::map<boost::filesystem::path, TempFile> m_tempFiles;
+    /* oldest first */
+    std::list<boost::filesystem::path> m_tempOrder;
+    std::map<std::string, CachedResult> m_cache;
+    /* least recently used first */
+    std::list<std::string> m_cacheOrder;
+    /* protects the temp file records and the result cache */
+    bplus::sync::Mutex m_tempLock;
+    bool m_compress;
+    bool m_compressCache;
+    unsigned int m_threads;
+    size_t m_sendWindow;
+    size_t m_ioBuffer;
+    unsigned int m_keepAliveIdle;
+    unsigned int m_keepAliveMax;
+    struct Connection {
+        unsigned int m_requests;
+        long long m_lastSeen;
+    };
+    std::map<unsigned long long, Connection> m_connections;
+    bplus::sync::Mutex m_connLock;
     struct mg_context* m_ctx;
-    bplus::sync::Mutex m_lock;
+    Metrics m_metrics;
     static FileServer* s_self;
 };
 
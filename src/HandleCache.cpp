@@ -0,0 +1,90 @@
+/**
+ *  A bounded cache of open read handles on served files.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "HandleCache.h"
+#include <time.h>
+
+HandleCache::HandleCache(size_t maxHandles, unsigned int recheckInterval) :
+    m_maxHandles(maxHandles),
+    m_recheckInterval(recheckInterval) {
+}
+
+HandleCache::~HandleCache() {
+}
+
+boost::shared_ptr<NativeFile>
+HandleCache::open(const boost::filesystem::path& path, FileIdentity& version) {
+    long long now = (long long) time(NULL);
+    boost::shared_ptr<NativeFile> f;
+    bool recheck = false;
+    {
+        bplus::sync::Lock lck(m_lock);
+        EntryMap::iterator it = m_entries.find(path);
+        if (it != m_entries.end()) {
+            f = it->second.m_file;
+            recheck = now - it->second.m_checked >= (long long) m_recheckInterval;
+            m_lru.splice(m_lru.begin(), m_lru, it->second.m_lru);
+        }
+    }
+    // the syscalls happen outside the lock
+    if (f) {
+        if (f->identity(version)) {
+            if (!recheck) {
+                return f;
+            }
+            FileIdentity current;
+            if (pathIdentity(path, current) && current.m_device == version.m_device
+                && current.m_inode == version.m_inode)
+            {
+                bplus::sync::Lock lck(m_lock);
+                EntryMap::iterator it = m_entries.find(path);
+                if (it != m_entries.end() && it->second.m_file == f) {
+                    it->second.m_checked = now;
+                }
+                return f;
+            }
+        }
+        f.reset();
+    }
+    f.reset(new NativeFile);
+    if (!f->openRead(path) || !f->identity(version)) {
+        forget(path);
+        return boost::shared_ptr<NativeFile>();
+    }
+    if (m_maxHandles == 0) {
+        return f;
+    }
+    bplus::sync::Lock lck(m_lock);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it == m_entries.end()) {
+        m_lru.push_front(path);
+        it = m_entries.insert(std::make_pair(path, Entry())).first;
+        it->second.m_lru = m_lru.begin();
+    }
+    it->second.m_file = f;
+    it->second.m_checked = now;
+    while (m_entries.size() > m_maxHandles) {
+        m_entries.erase(m_lru.back());
+        m_lru.pop_back();
+    }
+    return f;
+}
+
+void
+HandleCache::forget(const boost::filesystem::path& path) {
+    bplus::sync::Lock lck(m_lock);
+    EntryMap::iterator it = m_entries.find(path);
+    if (it != m_entries.end()) {
+        m_lru.erase(it->second.m_lru);
+        m_entries.erase(it);
+    }
+}
+
+size_t
+HandleCache::size() const {
+    bplus::sync::Lock lck(m_lock);
+    return m_entries.size();
+}
@@ -0,0 +1,57 @@
+/**
+ *  A bounded cache of open read handles on served files, so that repeat
+ *  requests for a hot url skip opening the file.  Handles are shared:
+ *  one evicted while a request is still sending from it stays open until
+ *  that request lets go of it.
+ *
+ *  A cached handle is checked with fstat on every use, which catches a
+ *  file modified in place.  Whether the path still names the same file
+ *  (it may have been replaced or removed) costs a stat of the path, and
+ *  that is only done once the handle has gone unchecked for a while.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __HANDLECACHE_H__
+#define __HANDLECACHE_H__
+
+#include "bputil/bpsync.h"
+#include "FileIO.h"
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+
+class HandleCache {
+public:
+    /* at most maxHandles kept open, paths are rechecked after
+     * recheckInterval seconds */
+    HandleCache(size_t maxHandles, unsigned int recheckInterval);
+    ~HandleCache();
+    /* a handle open on the file at path and its current identity, opening
+     * the file if there's no usable cached handle.  empty on error */
+    boost::shared_ptr<NativeFile> open(const boost::filesystem::path& path,
+                                       FileIdentity& version);
+    /* drop any handle on path */
+    void forget(const boost::filesystem::path& path);
+    size_t size() const;
+private:
+    HandleCache(const HandleCache&);
+    HandleCache& operator=(const HandleCache&);
+    /* most recently used at the front */
+    typedef std::list<boost::filesystem::path> LruList;
+    struct Entry {
+        boost::shared_ptr<NativeFile> m_file;
+        /* when the path was last seen to name the open file */
+        long long m_checked;
+        LruList::iterator m_lru;
+    };
+    typedef std::map<boost::filesystem::path, Entry> EntryMap;
+    size_t m_maxHandles;
+    unsigned int m_recheckInterval;
+    mutable bplus::sync::Mutex m_lock;
+    EntryMap m_entries;
+    LruList m_lru;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ *  Counters and latency histograms for the service's methods and its
+ *  http server.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "Metrics.h"
+#include <sstream>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+
+long long
+metricsNow()
+{
+#ifdef WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (long long) (now.QuadPart / freq.QuadPart) * 1000000
+        + (long long) (now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#elif defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+LatencyHistogram::LatencyHistogram() :
+    m_total(0),
+    m_max(0) {
+    memset((void*) m_counts, 0, sizeof(m_counts));
+}
+
+size_t
+LatencyHistogram::bucketOf(long long micros)
+{
+    if (micros < 2 * SubBuckets) {
+        return micros < 0 ? 0 : (size_t) micros;
+    }
+    unsigned int bits = 0;
+    while (bits < MaxBits && (micros >> (bits + 1)) != 0) {
+        bits++;
+    }
+    if (bits >= MaxBits) {
+        return Buckets - 1;
+    }
+    // the top SubBits + 1 bits pick the bucket within the power of two
+    unsigned int shift = bits - SubBits;
+    return (shift + 1) * SubBuckets + (size_t) (micros >> shift) - SubBuckets;
+}
+
+long long
+LatencyHistogram::bucketLimit(size_t bucket)
+{
+    if (bucket < 2 * SubBuckets) {
+        return (long long) bucket;
+    }
+    unsigned int shift = (unsigned int) (bucket / SubBuckets) - 1;
+    long long sub = (long long) (bucket % SubBuckets) + SubBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+void
+LatencyHistogram::record(long long micros)
+{
+    if (micros < 0) {
+        micros = 0;
+    }
+    atomicAdd(&m_counts[bucketOf(micros)], 1);
+    atomicAdd(&m_total, micros);
+    long long max = atomicLoad(&m_max);
+    while (micros > max && !atomicCompareAndSwap(&m_max, max, micros)) {
+        max = atomicLoad(&m_max);
+    }
+}
+
+void
+LatencyHistogram::summarize(LatencySummary& s)
+{
+    long long counts[Buckets];
+    long long count = 0;
+    for (size_t i = 0; i < Buckets; i++) {
+        counts[i] = atomicLoad(&m_counts[i]);
+        count += counts[i];
+    }
+    s.m_count = count;
+    s.m_total = atomicLoad(&m_total);
+    s.m_max = atomicLoad(&m_max);
+    // the percentiles walk the buckets once, in order
+    const double ps[] = { 0.50, 0.90, 0.99, 0.999 };
+    long long* out[] = { &s.m_p50, &s.m_p90, &s.m_p99, &s.m_p999 };
+    size_t b = 0;
+    long long seen = 0;
+    for (size_t i = 0; i < 4; i++) {
+        long long rank = (long long) (ps[i] * (double) count + 0.999999);
+        if (rank < 1) {
+            rank = 1;
+        }
+        while (b < Buckets && seen + counts[b] < rank) {
+            seen += counts[b++];
+        }
+        long long v = (count == 0 || b == Buckets) ? 0 : bucketLimit(b);
+        // the last bucket is open ended
+        *out[i] = (v > s.m_max || b == Buckets - 1) ? s.m_max : v;
+    }
+}
+
+Metrics::Metrics() :
+    m_started(metricsNow()),
+    m_bytesSent(0) {
+    memset((void*) m_statusCodes, 0, sizeof(m_statusCodes));
+}
+
+Metrics::~Metrics() {
+    std::map<std::string, LatencyHistogram*>::iterator it;
+    for (it = m_methods.begin(); it != m_methods.end(); ++it) {
+        delete it->second;
+    }
+}
+
+void
+Metrics::addMethod(const std::string& name) {
+    if (m_methods.find(name) == m_methods.end()) {
+        m_methods[name] = new LatencyHistogram;
+    }
+}
+
+void
+Metrics::recordMethod(const std::string& name, long long micros) {
+    // the map doesn't change once methods are recorded, so no lock
+    std::map<std::string, LatencyHistogram*>::iterator it = m_methods.find(name);
+    if (it != m_methods.end()) {
+        it->second->record(micros);
+    }
+}
+
+void
+Metrics::recordRequest(int status, long long bytes, long long micros) {
+    m_requests.record(micros);
+    atomicAdd(&m_bytesSent, bytes);
+    if (status >= MinStatus && status <= MaxStatus) {
+        atomicAdd(&m_statusCodes[status - MinStatus], 1);
+    }
+}
+
+void
+Metrics::snapshot(MetricsSnapshot& s) {
+    s.m_uptime = (metricsNow() - m_started) / 1000000;
+    s.m_methods.clear();
+    std::map<std::string, LatencyHistogram*>::iterator it;
+    for (it = m_methods.begin(); it != m_methods.end(); ++it) {
+        it->second->summarize(s.m_methods[it->first]);
+    }
+    m_requests.summarize(s.m_requests);
+    s.m_bytesSent = atomicLoad(&m_bytesSent);
+    s.m_statusCodes.clear();
+    for (int i = 0; i <= MaxStatus - MinStatus; i++) {
+        long long n = atomicLoad(&m_statusCodes[i]);
+        if (n) {
+            s.m_statusCodes[MinStatus + i] = n;
+        }
+    }
+}
+
+static void
+summaryJson(std::ostream& os, const LatencySummary& l)
+{
+    os << "{\"count\": " << l.m_count << ", \"totalMicros\": " << l.m_total
+       << ", \"maxMicros\": " << l.m_max << ", \"p50Micros\": " << l.m_p50
+       << ", \"p90Micros\": " << l.m_p90 << ", \"p99Micros\": " << l.m_p99
+       << ", \"p999Micros\": " << l.m_p999 << "}";
+}
+
+std::string
+metricsJson(const MetricsSnapshot& s)
+{
+    // method names are identifiers, nothing here needs escaping
+    std::stringstream os;
+    os << "{\"uptime\": " << s.m_uptime << ", \"methods\": {";
+    std::map<std::string, LatencySummary>::const_iterator m;
+    for (m = s.m_methods.begin(); m != s.m_methods.end(); ++m) {
+        os << (m == s.m_methods.begin() ? "" : ", ") << "\"" << m->first << "\": ";
+        summaryJson(os, m->second);
+    }
+    os << "}, \"http\": {\"requests\": ";
+    summaryJson(os, s.m_requests);
+    os << ", \"bytesSent\": " << s.m_bytesSent << ", \"statusCodes\": {";
+    std::map<int, long long>::const_iterator c;
+    for (c = s.m_statusCodes.begin(); c != s.m_statusCodes.end(); ++c) {
+        os << (c == s.m_statusCodes.begin() ? "" : ", ") << "\"" << c->first << "\": " << c->second;
+    }
+    os << "}}, \"tempStorage\": {\"files\": " << s.m_tempFiles << ", \"bytes\": " << s.m_tempBytes
+       << ", \"fileLimit\": " << s.m_tempFileLimit << ", \"byteLimit\": " << s.m_tempByteLimit
+       << "}, \"urls\": " << s.m_urls << ", \"openHandles\": " << s.m_openHandles << "}";
+    return os.str();
+}
@@ -0,0 +1,105 @@
+/**
+ *  Counters and latency histograms for the service's methods and its
+ *  http server.  Recording is lock free (atomic adds on preallocated
+ *  counters) so it can sit on every request; reading takes a snapshot,
+ *  which is only approximately consistent while recording goes on.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "Atomic.h"
+#include <map>
+#include <string>
+#include <stddef.h>
+
+/* microseconds from an arbitrary fixed point, for timing */
+long long metricsNow();
+
+/* what a LatencyHistogram has seen, in microseconds.  percentiles are
+ * the upper bound of the bucket they fall in, so they overstate by at
+ * most 1/8th */
+struct LatencySummary {
+    long long m_count;
+    long long m_total;
+    long long m_max;
+    long long m_p50;
+    long long m_p90;
+    long long m_p99;
+    long long m_p999;
+};
+
+/* an HDR style histogram of durations: buckets exact below 16us, then 8
+ * per power of two up to about 12 days (longer lands in the last) */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void record(long long micros);
+    void summarize(LatencySummary& s);
+private:
+    LatencyHistogram(const LatencyHistogram&);
+    LatencyHistogram& operator=(const LatencyHistogram&);
+    enum {
+        SubBits = 3,
+        SubBuckets = 1 << SubBits,
+        MaxBits = 40,
+        Buckets = (MaxBits - SubBits + 1) * SubBuckets
+    };
+    static size_t bucketOf(long long micros);
+    static long long bucketLimit(size_t bucket);
+    AtomicCounter m_counts[Buckets];
+    AtomicCounter m_total;
+    AtomicCounter m_max;
+};
+
+/* everything Metrics and its owner know, at one point in time */
+struct MetricsSnapshot {
+    long long m_uptime;
+    /* service method -> calls and their durations */
+    std::map<std::string, LatencySummary> m_methods;
+    /* http requests, body bytes sent, and requests by status code */
+    LatencySummary m_requests;
+    long long m_bytesSent;
+    std::map<int, long long> m_statusCodes;
+    /* chunk, slice and compressed files in the temp dir, and the limits
+     * on them */
+    long long m_tempFiles;
+    long long m_tempBytes;
+    long long m_tempFileLimit;
+    long long m_tempByteLimit;
+    /* outstanding urls and open handles on served files */
+    long long m_urls;
+    long long m_openHandles;
+};
+
+class Metrics {
+public:
+    Metrics();
+    ~Metrics();
+    /* a service method to time.  not thread safe: methods are added up
+     * front, before any are recorded */
+    void addMethod(const std::string& name);
+    /* a call to a method, ignored if it wasn't added */
+    void recordMethod(const std::string& name, long long micros);
+    /* an http response */
+    void recordRequest(int status, long long bytes, long long micros);
+    /* fills in what's recorded here, the temp storage and table sizes
+     * are left for the owner */
+    void snapshot(MetricsSnapshot& s);
+private:
+    Metrics(const Metrics&);
+    Metrics& operator=(const Metrics&);
+    enum { MinStatus = 100, MaxStatus = 599 };
+    long long m_started;
+    std::map<std::string, LatencyHistogram*> m_methods;
+    LatencyHistogram m_requests;
+    AtomicCounter m_bytesSent;
+    AtomicCounter m_statusCodes[MaxStatus - MinStatus + 1];
+};
+
+/* snapshot as a JSON object, the same shape the stats method returns */
+std::string metricsJson(const MetricsSnapshot& s);
+
+#endif
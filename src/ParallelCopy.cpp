@@ -0,0 +1,199 @@
+/**
+ *  Copies independent ranges of one source file into files of their
+ *  own, several at a time.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "ParallelCopy.h"
+#include "Atomic.h"
+#include "bputil/bpsync.h"
+#include "bputil/bpthread.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// per worker bounce buffer, used where the kernel can't copy for us
+#define PC_BUFSIZE (256 * 1024)
+
+namespace {
+
+struct CopyState {
+    const NativeFile* m_src;
+    const std::vector<RangeCopy>* m_ranges;
+    // next range to hand out
+    AtomicCounter m_next;
+    AtomicCounter m_failed;
+    RangeCopyListener* m_listener;
+    // guards m_err and serializes the listener
+    bplus::sync::Mutex m_lock;
+    std::string m_err;
+};
+
+bool
+copyOne(const NativeFile& src, const RangeCopy& r, char* buf, std::string& err)
+{
+    NativeFile out;
+    bool write = !r.m_dest.empty();
+    if (write && !out.openWrite(r.m_dest)) {
+        err = "unable to open temp chunk file";
+        return false;
+    }
+    long long done = 0;
+    if (write && !r.m_digests) {
+        done = copyFileRange(src, r.m_offset, out, 0, r.m_size);
+        if (done < 0) {
+            done = 0;
+        }
+    }
+    while (done < r.m_size) {
+        size_t amt = PC_BUFSIZE;
+        if ((long long) amt > r.m_size - done) amt = (size_t) (r.m_size - done);
+        long long numRead = src.readAt(buf, amt, r.m_offset + done);
+        if (numRead < 0) {
+            err = "error reading file";
+            return false;
+        }
+        if (numRead == 0) {
+            err = "file changed while chunking";
+            return false;
+        }
+        if (r.m_digests) {
+            r.m_digests->update(buf, (size_t) numRead);
+        }
+        if (write && out.writeAt(buf, (size_t) numRead, done) != numRead) {
+            err = "error writing to temp chunk file";
+            return false;
+        }
+        done += numRead;
+    }
+    return true;
+}
+
+void*
+copyWorker(void* ctx)
+{
+    CopyState* st = (CopyState*) ctx;
+    char* buf = new char[PC_BUFSIZE];
+    std::string err;
+    while (!atomicLoad(&st->m_failed)) {
+        long long i = atomicAdd(&st->m_next, 1) - 1;
+        if (i >= (long long) st->m_ranges->size()) {
+            break;
+        }
+        if (!copyOne(*st->m_src, (*st->m_ranges)[(size_t) i], buf, err)) {
+            // first failure wins, the others stop at their next range
+            if (atomicCompareAndSwap(&st->m_failed, 0, 1)) {
+                bplus::sync::Lock lck(st->m_lock);
+                st->m_err = err;
+            }
+            break;
+        }
+        if (st->m_listener) {
+            bplus::sync::Lock lck(st->m_lock);
+            st->m_listener->rangeCopied((size_t) i);
+        }
+    }
+    delete [] buf;
+    return NULL;
+}
+
+struct TaskState {
+    ParallelTask* m_task;
+    size_t m_count;
+    AtomicCounter m_next;
+};
+
+void*
+taskWorker(void* ctx)
+{
+    TaskState* st = (TaskState*) ctx;
+    for (;;) {
+        long long i = atomicAdd(&st->m_next, 1) - 1;
+        if (i >= (long long) st->m_count) {
+            break;
+        }
+        st->m_task->run((size_t) i);
+    }
+    return NULL;
+}
+
+// run worker on ctx in the calling thread plus up to helpers more
+void
+runWorkers(void* (*worker)(void*), void* ctx, size_t helpers)
+{
+    std::vector<bplus::thread::Thread*> threads;
+    for (size_t i = 0; i < helpers; i++) {
+        bplus::thread::Thread* t = new bplus::thread::Thread;
+        if (!t->run(worker, ctx)) {
+            // carry on with however many we got
+            delete t;
+            break;
+        }
+        threads.push_back(t);
+    }
+    worker(ctx);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
+
+// helper threads worth starting for count items
+size_t
+helperCount(size_t count, unsigned int maxThreads)
+{
+    if (maxThreads <= 1 || count <= 1) {
+        return 0;
+    }
+    size_t helpers = maxThreads - 1;
+    return helpers > count - 1 ? count - 1 : helpers;
+}
+
+}
+
+bool
+copyRanges(const NativeFile& src, const std::vector<RangeCopy>& ranges,
+           unsigned int maxThreads, std::string& err,
+           RangeCopyListener* listener)
+{
+    CopyState st;
+    st.m_src = &src;
+    st.m_ranges = &ranges;
+    st.m_next = 0;
+    st.m_failed = 0;
+    st.m_listener = listener;
+
+    runWorkers(copyWorker, &st, helperCount(ranges.size(), maxThreads));
+    if (st.m_failed) {
+        err = st.m_err;
+        return false;
+    }
+    return true;
+}
+
+void
+runParallel(ParallelTask& task, size_t count, unsigned int maxThreads)
+{
+    TaskState st;
+    st.m_task = &task;
+    st.m_count = count;
+    st.m_next = 0;
+    runWorkers(taskWorker, &st, helperCount(count, maxThreads));
+}
+
+unsigned int
+processorCount()
+{
+#ifdef WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    long n = (long) si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? (unsigned int) n : 1;
+}
@@ -0,0 +1,63 @@
+/**
+ *  Copies independent ranges of one source file into files of their
+ *  own, several at a time.  Each range is written with positional i/o
+ *  so workers never share a file pointer, and output is identical to
+ *  copying the ranges one after another.  runParallel hands out other
+ *  independent work over threads the same way.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __PARALLELCOPY_H__
+#define __PARALLELCOPY_H__
+
+#include "FileIO.h"
+#include "Digest.h"
+#include <boost/filesystem.hpp>
+#include <string>
+#include <vector>
+
+/* a range of the source and the file it should end up in.  an empty
+ * m_dest only reads the range, for the sake of m_digests.  when
+ * m_digests is set the range is read through a buffer and fed to it
+ * rather than left to the kernel to copy */
+struct RangeCopy {
+    long long m_offset;
+    long long m_size;
+    boost::filesystem::path m_dest;
+    DigestSet* m_digests;
+};
+
+/* told about each range as soon as it has been written.  called from
+ * the copying threads, one call at a time */
+class RangeCopyListener {
+public:
+    virtual ~RangeCopyListener() {}
+    virtual void rangeCopied(size_t index) = 0;
+};
+
+/* copy every range of src to its destination, using at most maxThreads
+ * threads (the caller's included).  on failure the first error is
+ * returned in err, remaining ranges are skipped and destinations that
+ * were already written are left for the caller to remove. */
+bool copyRanges(const NativeFile& src, const std::vector<RangeCopy>& ranges,
+                unsigned int maxThreads, std::string& err,
+                RangeCopyListener* listener = NULL);
+
+/* independent items of work for runParallel */
+class ParallelTask {
+public:
+    virtual ~ParallelTask() {}
+    /* do item index.  called from several threads at once, each item
+     * exactly once */
+    virtual void run(size_t index) = 0;
+};
+
+/* run items 0..count-1 of task using at most maxThreads threads (the
+ * caller's included), returning once all are done */
+void runParallel(ParallelTask& task, size_t count, unsigned int maxThreads);
+
+/* number of processors currently online, at least 1 */
+unsigned int processorCount();
+
+#endif
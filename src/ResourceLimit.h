@@ -1,5 +1,6 @@
 /**
- *  A class to implement resource limiting.
+ *  A class to implement resource limiting.  Usage is tracked with atomic
+ *  counters, so a limit may be shared between concurrent transactions.
  *
  *  (c) 2010 Yahoo! inc.
  */
@@ -7,6 +8,9 @@
 #ifndef __RESOURCE_LIMIT_H__
 #define __RESOURCE_LIMIT_H__
 
+#include "Atomic.h"
+#include <stddef.h>
+
 class ResourceLimit {
 public:
     ResourceLimit(size_t fileLimit, size_t byteLimit) :
@@ -15,22 +19,48 @@ public:
         m_filesUsed(0),
         m_bytesUsed(0) {
     }
-    bool wouldExceed(size_t files, size_t bytes) {
-        if (m_filesUsed + files > m_fileLimit) {
-            return true;
+    /* check and reserve usage in one step, false (and nothing reserved)
+     * if the usage would exceed either limit */
+    bool tryReserve(size_t files, size_t bytes) {
+        if (!reserve(&m_filesUsed, (long long) files, (long long) m_fileLimit)) {
+            return false;
         }
-        if (m_bytesUsed + bytes > m_byteLimit) {
-            return true;
+        if (!reserve(&m_bytesUsed, (long long) bytes, (long long) m_byteLimit)) {
+            atomicAdd(&m_filesUsed, -(long long) files);
+            return false;
         }
-        return false;
+        return true;
+    }
+    /* give back usage previously reserved */
+    void release(size_t files, size_t bytes) {
+        atomicAdd(&m_filesUsed, -(long long) files);
+        atomicAdd(&m_bytesUsed, -(long long) bytes);
     }
-    void noteUsage(size_t files, size_t bytes) {
-        m_filesUsed += files;
-        m_bytesUsed += bytes;
+    size_t filesUsed() { return (size_t) atomicLoad(&m_filesUsed); }
+    size_t bytesUsed() { return (size_t) atomicLoad(&m_bytesUsed); }
+    /* change the limits.  not thread safe, for use before anything is
+     * reserved */
+    void setLimits(size_t fileLimit, size_t byteLimit) {
+        m_fileLimit = fileLimit;
+        m_byteLimit = byteLimit;
     }
+    size_t fileLimit() const { return m_fileLimit; }
+    size_t byteLimit() const { return m_byteLimit; }
 private:
+    static bool reserve(AtomicCounter* used, long long amount, long long limit) {
+        long long cur = atomicLoad(used);
+        do {
+            if (cur + amount > limit) {
+                return false;
+            }
+            if (atomicCompareAndSwap(used, cur, cur + amount)) {
+                return true;
+            }
+            cur = atomicLoad(used);
+        } while (true);
+    }
     size_t m_fileLimit, m_byteLimit;
-    size_t m_filesUsed, m_bytesUsed;
+    AtomicCounter m_filesUsed, m_bytesUsed;
 };
 
 #endif
@@ -0,0 +1,26 @@
+/**
+ *  Where a window into UTF-8 text has to end so as not to split a
+ *  character.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "TextScan.h"
+
+size_t
+incompleteTail(const unsigned char* p, size_t len)
+{
+    // walk back over continuation bytes to the lead byte, if it's close
+    for (size_t n = 1; n <= 3 && n <= len; n++) {
+        unsigned char c = p[len - n];
+        if ((c & 0xc0) == 0x80) {
+            continue;
+        }
+        size_t want = 1;
+        if (c >= 0xf0) want = 4;
+        else if (c >= 0xe0) want = 3;
+        else if (c >= 0xc0) want = 2;
+        return want > n ? n : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+/**
+ *  Where a window into UTF-8 text has to end so as not to split a
+ *  character.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __TEXTSCAN_H__
+#define __TEXTSCAN_H__
+
+#include <stddef.h>
+
+/* number of bytes at the end of p that start a multi-byte character
+ * without completing it (0 to 3), i.e. where a window has to be cut
+ * short to end on a character boundary */
+size_t incompleteTail(const unsigned char* p, size_t len);
+
+#endif
@@ -0,0 +1,179 @@
+/**
+ *  The table of url tokens handed out by FileServer::addFile, keyed by
+ *  the binary form of the uuid.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "TokenTable.h"
+#include <string.h>
+#include <time.h>
+
+// expired entries looked at per insert, keeps the cost of an insert bounded
+#define TT_MAX_EXPIRE_SCAN 8
+
+static int
+hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+Token::Token() {
+    memset(m_bytes, 0, sizeof(m_bytes));
+}
+
+bool
+Token::parse(const std::string& s, Token& t) {
+    // xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+    if (s.length() != 36) {
+        return false;
+    }
+    size_t b = 0;
+    for (size_t i = 0; i < s.length(); ) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            if (s[i] != '-') {
+                return false;
+            }
+            i++;
+            continue;
+        }
+        int hi = hexValue(s[i]), lo = hexValue(s[i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        t.m_bytes[b++] = (unsigned char) ((hi << 4) | lo);
+        i += 2;
+    }
+    return b == sizeof(t.m_bytes);
+}
+
+bool
+Token::operator==(const Token& other) const {
+    return memcmp(m_bytes, other.m_bytes, sizeof(m_bytes)) == 0;
+}
+
+size_t
+Token::hash() const {
+    // uuids are random already, fold the halves together
+    unsigned long long a, b;
+    memcpy(&a, m_bytes, sizeof(a));
+    memcpy(&b, m_bytes + sizeof(a), sizeof(b));
+    return (size_t) (a ^ (b * 0x9e3779b97f4a7c15ULL));
+}
+
+bool
+TokenTable::Entry::expired(long long now) const {
+    if (m_lifetime && now - m_created >= (long long) m_lifetime) {
+        return true;
+    }
+    if (m_idleTtl && now - m_lastUsed >= (long long) m_idleTtl) {
+        return true;
+    }
+    return false;
+}
+
+TokenTable::TokenTable(size_t maxEntries) :
+    m_maxPerShard(0) {
+    if (maxEntries > 0) {
+        m_maxPerShard = (maxEntries + NumShards - 1) / NumShards;
+    }
+}
+
+TokenTable::~TokenTable() {
+}
+
+TokenTable::Shard&
+TokenTable::shardFor(const Token& token) const {
+    // use the high bits, the low ones pick the bucket within the shard
+    size_t h = token.hash();
+    return m_shards[(h >> (sizeof(size_t) * 8 - 8)) % NumShards];
+}
+
+void
+TokenTable::evict(Shard& shard, long long now) {
+    for (size_t i = 0; i < TT_MAX_EXPIRE_SCAN && !shard.m_lru.empty(); i++) {
+        EntryMap::iterator it = shard.m_entries.find(shard.m_lru.back());
+        if (!it->second.expired(now)) {
+            break;
+        }
+        shard.m_lru.pop_back();
+        shard.m_entries.erase(it);
+    }
+    while (m_maxPerShard && shard.m_entries.size() > m_maxPerShard) {
+        shard.m_entries.erase(shard.m_lru.back());
+        shard.m_lru.pop_back();
+    }
+}
+
+void
+TokenTable::insert(const Token& token, const ServedFile& file,
+                   unsigned int idleTtl, unsigned int lifetime) {
+    long long now = (long long) time(NULL);
+    Shard& shard = shardFor(token);
+    bplus::sync::Lock lck(shard.m_lock);
+    EntryMap::iterator it = shard.m_entries.find(token);
+    if (it != shard.m_entries.end()) {
+        shard.m_lru.erase(it->second.m_lru);
+        shard.m_entries.erase(it);
+    }
+    shard.m_lru.push_front(token);
+    Entry& e = shard.m_entries[token];
+    e.m_file = file;
+    e.m_created = now;
+    e.m_lastUsed = now;
+    e.m_idleTtl = idleTtl;
+    e.m_lifetime = lifetime;
+    e.m_lru = shard.m_lru.begin();
+    evict(shard, now);
+}
+
+bool
+TokenTable::find(const Token& token, ServedFile& file) {
+    long long now = (long long) time(NULL);
+    Shard& shard = shardFor(token);
+    bplus::sync::Lock lck(shard.m_lock);
+    EntryMap::iterator it = shard.m_entries.find(token);
+    if (it == shard.m_entries.end()) {
+        return false;
+    }
+    Entry& e = it->second;
+    if (e.expired(now)) {
+        shard.m_lru.erase(e.m_lru);
+        shard.m_entries.erase(it);
+        return false;
+    }
+    e.m_lastUsed = now;
+    // move to the front, splice keeps the stored iterator valid
+    shard.m_lru.splice(shard.m_lru.begin(), shard.m_lru, e.m_lru);
+    file = e.m_file;
+    return true;
+}
+
+bool
+TokenTable::remove(const Token& token, ServedFile* file) {
+    Shard& shard = shardFor(token);
+    bplus::sync::Lock lck(shard.m_lock);
+    EntryMap::iterator it = shard.m_entries.find(token);
+    if (it == shard.m_entries.end()) {
+        return false;
+    }
+    if (file) {
+        *file = it->second.m_file;
+    }
+    shard.m_lru.erase(it->second.m_lru);
+    shard.m_entries.erase(it);
+    return true;
+}
+
+size_t
+TokenTable::size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < NumShards; i++) {
+        bplus::sync::Lock lck(m_shards[i].m_lock);
+        n += m_shards[i].m_entries.size();
+    }
+    return n;
+}
@@ -0,0 +1,97 @@
+/**
+ *  The table of url tokens handed out by FileServer::addFile, keyed by
+ *  the binary form of the uuid.  Entries are spread over independently
+ *  locked shards so that concurrent lookups from mongoose worker threads
+ *  (and registrations from getURL) rarely contend.
+ *
+ *  Entries expire after an idle and/or absolute lifetime, and each shard
+ *  is capped, evicting its least recently used entry when full.  Expiry
+ *  is checked lazily as entries are looked up or inserted, there is no
+ *  background sweep.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __TOKENTABLE_H__
+#define __TOKENTABLE_H__
+
+#include "bputil/bpsync.h"
+#include <boost/filesystem.hpp>
+#include <boost/unordered_map.hpp>
+#include <list>
+#include <string>
+
+/* a 128 bit uuid */
+class Token {
+public:
+    Token();
+    /* parse the canonical 36 character form, false if malformed */
+    static bool parse(const std::string& s, Token& t);
+    bool operator==(const Token& other) const;
+    size_t hash() const;
+    const unsigned char* bytes() const { return m_bytes; }
+private:
+    unsigned char m_bytes[16];
+};
+
+struct TokenHash {
+    size_t operator()(const Token& t) const { return t.hash(); }
+};
+
+/* what a url token resolves to */
+struct ServedFile {
+    boost::filesystem::path m_path;
+    long long m_offset;
+    long long m_size;
+    /* looked up once when the token is handed out, empty if unknown */
+    std::string m_mimeType;
+};
+
+class TokenTable {
+public:
+    /* maxEntries is spread evenly over the shards, 0 means unbounded */
+    TokenTable(size_t maxEntries = 0);
+    ~TokenTable();
+    /* add an entry.  idleTtl and lifetime are in seconds, 0 means the
+     * entry never expires on that account */
+    void insert(const Token& token, const ServedFile& file,
+                unsigned int idleTtl = 0, unsigned int lifetime = 0);
+    /* copy the entry for token into file, false if not present or
+     * expired.  counts as a use of the entry. */
+    bool find(const Token& token, ServedFile& file);
+    /* drop the entry for token, copying it into file if that's given.
+     * false if not present */
+    bool remove(const Token& token, ServedFile* file = NULL);
+    size_t size() const;
+private:
+    TokenTable(const TokenTable&);
+    TokenTable& operator=(const TokenTable&);
+    enum { NumShards = 32 };
+    /* most recently used at the front */
+    typedef std::list<Token> LruList;
+    struct Entry {
+        ServedFile m_file;
+        long long m_created;
+        long long m_lastUsed;
+        unsigned int m_idleTtl;
+        unsigned int m_lifetime;
+        LruList::iterator m_lru;
+        bool expired(long long now) const;
+    };
+    typedef boost::unordered_map<Token, Entry, TokenHash> EntryMap;
+    struct Shard {
+        bplus::sync::Mutex m_lock;
+        EntryMap m_entries;
+        LruList m_lru;
+        // keep neighbouring shard locks off the same cache line
+        char m_pad[64];
+    };
+    Shard& shardFor(const Token& token) const;
+    /* drop expired entries from the cold end of shard's lru, then the
+     * coldest live ones while the shard is over capacity */
+    void evict(Shard& shard, long long now);
+    size_t m_maxPerShard;
+    mutable Shard m_shards[NumShards];
+};
+
+#endif
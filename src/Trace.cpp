@@ -0,0 +1,172 @@
+/**
+ *  A ring buffer of structured trace events.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "Trace.h"
+#include "Atomic.h"
+#include "Metrics.h"
+#include "bputil/bpsync.h"
+#include <iomanip>
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// smallest and largest buffers, in events
+#define TRACE_MIN_EVENTS 64
+#define TRACE_MAX_EVENTS (1 << 20)
+
+struct TraceEvent {
+    long long m_time;
+    long long m_duration;
+    long long m_bytes;
+    const char* m_name;
+    const char* m_stage;
+    int m_status;
+    bool m_hasToken;
+    unsigned long m_thread;
+    unsigned char m_token[16];
+};
+
+// m_sequence is the number of the event in the slot, -1 while it's
+// being written
+struct TraceSlot {
+    AtomicCounter m_sequence;
+    TraceEvent m_event;
+};
+
+volatile int Trace::s_level = Trace::Off;
+
+static TraceSlot* s_slots = NULL;
+static long long s_mask = 0;
+static AtomicCounter s_next = 0;
+static AtomicCounter s_started = 0;
+static volatile unsigned int s_sampleEvery = 1;
+static bplus::sync::Mutex s_configLock;
+
+static unsigned long
+threadId()
+{
+#ifdef WIN32
+    return (unsigned long) GetCurrentThreadId();
+#else
+    return (unsigned long) pthread_self();
+#endif
+}
+
+// a token is all it takes to fetch its file, so a dump only has a 32 bit
+// hash of it (FNV-1a): enough to tell requests for different urls apart,
+// nowhere near enough to get the token back
+static unsigned int
+tokenHash(const unsigned char* bytes, size_t len)
+{
+    unsigned int h = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ bytes[i]) * 16777619U;
+    }
+    return h;
+}
+
+void
+Trace::configure(Level level, unsigned int sampleEvery, size_t events)
+{
+    bplus::sync::Lock lck(s_configLock);
+    if (level != Off && s_slots == NULL) {
+        if (events < TRACE_MIN_EVENTS) events = TRACE_MIN_EVENTS;
+        if (events > TRACE_MAX_EVENTS) events = TRACE_MAX_EVENTS;
+        size_t n = TRACE_MIN_EVENTS;
+        while (n < events) {
+            n <<= 1;
+        }
+        TraceSlot* slots = new TraceSlot[n];
+        for (size_t i = 0; i < n; i++) {
+            slots[i].m_sequence = -1;
+        }
+        s_mask = (long long) n - 1;
+        s_slots = slots;
+    }
+    s_sampleEvery = sampleEvery ? sampleEvery : 1;
+    // the buffer is in place before anyone can see tracing is on
+    atomicAdd(&s_next, 0);
+    s_level = level;
+}
+
+bool
+Trace::sample()
+{
+    if (s_level == Off) {
+        return false;
+    }
+    unsigned int every = s_sampleEvery;
+    return every <= 1 || atomicAdd(&s_started, 1) % every == 0;
+}
+
+void
+Trace::record(const char* name, const char* stage, const Token* token,
+              int status, long long bytes, long long duration)
+{
+    if (s_level == Off) {
+        return;
+    }
+    long long n = atomicAdd(&s_next, 1) - 1;
+    TraceSlot& slot = s_slots[n & s_mask];
+    atomicStore(&slot.m_sequence, -1);
+    TraceEvent& e = slot.m_event;
+    e.m_time = metricsNow();
+    e.m_duration = duration;
+    e.m_bytes = bytes;
+    e.m_name = name;
+    e.m_stage = stage;
+    e.m_status = status;
+    e.m_hasToken = token != NULL;
+    e.m_thread = threadId();
+    if (token) {
+        memcpy(e.m_token, token->bytes(), sizeof(e.m_token));
+    }
+    atomicStore(&slot.m_sequence, n);
+}
+
+size_t
+Trace::dump(std::ostream& os)
+{
+    long long now = metricsNow();
+    os << "# FileAccess trace at " << (long long) time(NULL) << " (" << now
+       << " on the event clock)\n"
+       << "# time thread name stage token status bytes micros\n";
+    if (s_slots == NULL) {
+        return 0;
+    }
+    long long last = atomicLoad(&s_next);
+    long long first = last - (s_mask + 1);
+    if (first < 0) {
+        first = 0;
+    }
+    size_t written = 0;
+    for (long long n = first; n < last; n++) {
+        TraceSlot& slot = s_slots[n & s_mask];
+        if (atomicLoad(&slot.m_sequence) != n) {
+            continue;
+        }
+        TraceEvent e = slot.m_event;
+        // overwritten while we copied it
+        if (atomicLoad(&slot.m_sequence) != n) {
+            continue;
+        }
+        os << e.m_time << ' ' << e.m_thread << ' ' << e.m_name << ' ' << e.m_stage << ' ';
+        if (e.m_hasToken) {
+            os << std::hex << std::setfill('0') << std::setw(8)
+               << tokenHash(e.m_token, sizeof(e.m_token))
+               << std::dec << std::setfill(' ');
+        } else {
+            os << '-';
+        }
+        os << ' ' << e.m_status << ' ' << e.m_bytes << ' ' << e.m_duration << '\n';
+        written++;
+    }
+    return written;
+}
@@ -0,0 +1,57 @@
+/**
+ *  A ring buffer of structured trace events for http requests and
+ *  service method calls, in place of logging a line per request.  An
+ *  event is a few integers and pointers to string literals written into
+ *  a preallocated slot, with no formatting or allocation; the text form
+ *  is only produced when the buffer is dumped.
+ *
+ *  Tracing is off by default, and then costs one load and compare per
+ *  request.  When on, 1 in every sampleEvery requests (and method calls)
+ *  is traced, at one of two levels: Requests records one event as each
+ *  finishes, Stages also records the steps along the way.
+ *
+ *  The buffer is shared by all threads: writers claim slots with an
+ *  atomic increment and never wait on each other.  Once it wraps the
+ *  oldest events are overwritten.  A dump skips any slot being written
+ *  while it is read.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "TokenTable.h"
+#include <ostream>
+#include <stddef.h>
+
+class Trace {
+public:
+    enum Level {
+        Off = 0,
+        Requests = 1,
+        Stages = 2
+    };
+    /* trace at level, 1 in sampleEvery requests and calls, keeping the
+     * last events events (rounded up to a power of two).  the buffer is
+     * allocated when tracing is first turned on and kept for the life of
+     * the process, later calls can't change its size */
+    static void configure(Level level, unsigned int sampleEvery, size_t events);
+    static bool enabled(Level level) { return s_level >= (int) level; }
+    /* whether to trace a request or call that's starting, false whenever
+     * tracing is off */
+    static bool sample();
+    /* an event.  name and stage must be string literals (only the
+     * pointers are kept), token may be NULL.  duration is microseconds
+     * since the request or call began */
+    static void record(const char* name, const char* stage, const Token* token,
+                       int status, long long bytes, long long duration);
+    /* the buffered events as text, oldest first, one per line.  tokens
+     * are written as 8 hex digits of a hash, never in full.  returns the
+     * number written */
+    static size_t dump(std::ostream& os);
+private:
+    static volatile int s_level;
+};
+
+#endif
@@ -0,0 +1,371 @@
+/**
+ *  Buffer level base64 encoding and decoding for the Base64 class.
+ *
+ *  The SIMD kernels follow the approach described by Wojciech Mula and
+ *  Daniel Lemire ("Faster Base64 Encoding and Decoding using AVX2
+ *  Instructions"): bytes are reshuffled into 6 bit indices with
+ *  multiplies, and mapped to/from ASCII with small nibble lookups.
+ *  The kernel is chosen once, at first use, from what the cpu supports.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "base64.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B64_X86 1
+#define B64_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define B64_X86 1
+#define B64_TARGET(x)
+#include <intrin.h>
+#endif
+
+#ifdef B64_X86
+#include <immintrin.h>
+#endif
+
+static const char s_encodeTable[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+// 0xff for characters outside the alphabet (padding, line breaks, noise)
+static unsigned char s_decodeTable[256];
+
+static void
+initDecodeTable()
+{
+    for (int i = 0; i < 256; i++) {
+        s_decodeTable[i] = 0xff;
+    }
+    for (int i = 0; i < 64; i++) {
+        s_decodeTable[(unsigned char) s_encodeTable[i]] = (unsigned char) i;
+    }
+}
+
+// scalar encode of len bytes, len need not be a multiple of 3
+static size_t
+encodeScalar(const unsigned char* in, size_t len, char* out)
+{
+    char* o = out;
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        unsigned int v = ((unsigned int) in[i] << 16)
+            | ((unsigned int) in[i + 1] << 8) | in[i + 2];
+        o[0] = s_encodeTable[(v >> 18) & 0x3f];
+        o[1] = s_encodeTable[(v >> 12) & 0x3f];
+        o[2] = s_encodeTable[(v >> 6) & 0x3f];
+        o[3] = s_encodeTable[v & 0x3f];
+        o += 4;
+    }
+    if (i < len) {
+        unsigned int v = (unsigned int) in[i] << 16;
+        if (i + 1 < len) {
+            v |= (unsigned int) in[i + 1] << 8;
+        }
+        o[0] = s_encodeTable[(v >> 18) & 0x3f];
+        o[1] = s_encodeTable[(v >> 12) & 0x3f];
+        o[2] = (i + 1 < len) ? s_encodeTable[(v >> 6) & 0x3f] : '=';
+        o[3] = '=';
+        o += 4;
+    }
+    return (size_t) (o - out);
+}
+
+// scalar decode, skipping anything outside the alphabet.  a trailing
+// partial quantum of n characters yields n - 1 bytes.
+static size_t
+decodeScalar(const char* in, size_t len, unsigned char* out)
+{
+    unsigned char* o = out;
+    unsigned int acc = 0;
+    int n = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char v = s_decodeTable[(unsigned char) in[i]];
+        if (v == 0xff) {
+            continue;
+        }
+        acc = (acc << 6) | v;
+        if (++n == 4) {
+            o[0] = (unsigned char) (acc >> 16);
+            o[1] = (unsigned char) (acc >> 8);
+            o[2] = (unsigned char) acc;
+            o += 3;
+            acc = 0;
+            n = 0;
+        }
+    }
+    if (n > 1) {
+        acc <<= 6 * (4 - n);
+        o[0] = (unsigned char) (acc >> 16);
+        if (n > 2) {
+            o[1] = (unsigned char) (acc >> 8);
+        }
+        o += n - 1;
+    }
+    return (size_t) (o - out);
+}
+
+#ifdef B64_X86
+
+// split 12 bytes (in the low 12 of each 16) into 16 six bit indices
+B64_TARGET("ssse3") static inline __m128i
+encReshuffle128(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// map six bit indices to the base64 alphabet
+B64_TARGET("ssse3") static inline __m128i
+encTranslate128(__m128i in)
+{
+    const __m128i lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    __m128i idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    idx = _mm_or_si128(idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
+
+B64_TARGET("ssse3") static size_t
+encodeSSSE3(const unsigned char* in, size_t len, char* out)
+{
+    size_t i = 0;
+    char* o = out;
+    // each step consumes 12 bytes but loads 16
+    for (; i + 16 <= len; i += 12) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + i));
+        v = encTranslate128(encReshuffle128(v));
+        _mm_storeu_si128((__m128i*) o, v);
+        o += 16;
+    }
+    return (size_t) (o - out) + encodeScalar(in + i, len - i, o);
+}
+
+B64_TARGET("avx2") static size_t
+encodeAVX2(const unsigned char* in, size_t len, char* out)
+{
+    size_t i = 0;
+    char* o = out;
+    const __m256i shuf = _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    // each step consumes 24 bytes (12 per lane) but loads 28
+    for (; i + 28 <= len; i += 24) {
+        __m128i lo = _mm_loadu_si128((const __m128i*) (in + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*) (in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        v = _mm256_or_si256(t1, t3);
+        __m256i idx = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+        idx = _mm256_or_si256(idx, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut, idx));
+        _mm256_storeu_si256((__m256i*) o, v);
+        o += 32;
+    }
+    return (size_t) (o - out) + encodeSSSE3(in + i, len - i, o);
+}
+
+// translate 16 characters to six bit values, false if any character is
+// outside the alphabet (the block is then left to the scalar decoder)
+B64_TARGET("ssse3") static inline bool
+decTranslate128(__m128i& v)
+{
+    const __m128i lutLo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2f = _mm_set1_epi8(0x2f);
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask2f);
+    __m128i loNibbles = _mm_and_si128(v, mask2f);
+    __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(bad) != 0xffff) {
+        return false;
+    }
+    __m128i eq2f = _mm_cmpeq_epi8(v, mask2f);
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2f, hiNibbles));
+    v = _mm_add_epi8(v, roll);
+    return true;
+}
+
+// pack 16 six bit values into 12 bytes (in the low 12 of 16)
+B64_TARGET("ssse3") static inline __m128i
+decPack128(__m128i v)
+{
+    __m128i merged = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                             14, 13, 12, -1, -1, -1, -1));
+}
+
+B64_TARGET("ssse3") static size_t
+decodeSSSE3(const char* in, size_t len, unsigned char* out)
+{
+    size_t i = 0;
+    unsigned char* o = out;
+    // stop early enough that the 16 byte store stays inside
+    // decodedMaxLength(len), and padding at the tail goes to the scalar path
+    while (i + 24 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + i));
+        if (!decTranslate128(v)) {
+            break;
+        }
+        // stores 16, of which 12 are kept
+        _mm_storeu_si128((__m128i*) o, decPack128(v));
+        o += 12;
+        i += 16;
+    }
+    return (size_t) (o - out) + decodeScalar(in + i, len - i, o);
+}
+
+B64_TARGET("avx2") static size_t
+decodeAVX2(const char* in, size_t len, unsigned char* out)
+{
+    size_t i = 0;
+    unsigned char* o = out;
+    const __m256i lutLo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lutHi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i mask2f = _mm256_set1_epi8(0x2f);
+    while (i + 40 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (in + i));
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask2f);
+        __m256i loNibbles = _mm256_and_si256(v, mask2f);
+        __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i eq2f = _mm256_cmpeq_epi8(v, mask2f);
+        __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2f, hiNibbles));
+        v = _mm256_add_epi8(v, roll);
+        __m256i merged = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        // 12 bytes per lane, written as two overlapping 16 byte stores
+        _mm_storeu_si128((__m128i*) o, _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i*) (o + 12), _mm256_extracti128_si256(v, 1));
+        o += 24;
+        i += 32;
+    }
+    return (size_t) (o - out) + decodeSSSE3(in + i, len - i, o);
+}
+
+#endif // B64_X86
+
+typedef size_t (*EncodeFunc)(const unsigned char*, size_t, char*);
+typedef size_t (*DecodeFunc)(const char*, size_t, unsigned char*);
+
+static EncodeFunc s_encode = NULL;
+static DecodeFunc s_decode = NULL;
+static const char* s_kernel = NULL;
+
+static void
+selectKernel()
+{
+    if (s_kernel) {
+        return;
+    }
+    // racing threads all reach the same answer, so no lock is needed
+    initDecodeTable();
+    EncodeFunc enc = encodeScalar;
+    DecodeFunc dec = decodeScalar;
+    const char* name = "scalar";
+#ifdef B64_X86
+    bool ssse3 = false, avx2 = false;
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    ssse3 = (info[2] & (1 << 9)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+    if (avx2) {
+        enc = encodeAVX2;
+        dec = decodeAVX2;
+        name = "avx2";
+    } else if (ssse3) {
+        enc = encodeSSSE3;
+        dec = decodeSSSE3;
+        name = "ssse3";
+    }
+#endif
+    s_encode = enc;
+    s_decode = dec;
+    s_kernel = name;
+}
+
+// pick the kernel at load time, before any service thread can race on it
+static struct KernelInit {
+    KernelInit() { selectKernel(); }
+} s_kernelInit;
+
+size_t
+Base64::encode(const unsigned char* in, size_t len, char* out)
+{
+    selectKernel();
+    return s_encode(in, len, out);
+}
+
+size_t
+Base64::decode(const char* in, size_t len, unsigned char* out)
+{
+    selectKernel();
+    return s_decode(in, len, out);
+}
+
+const char*
+Base64::kernel()
+{
+    selectKernel();
+    return s_kernel;
+}
@@ -202,10 +202,11 @@ VERSION HISTORY:
 #ifndef __BASE64_HPP__
 #define __BASE64_HPP__
 
-// tweaked to use C++ streams and be a header only C++ class.
+// tweaked to use C++ streams.  the stream interfaces are layered on a
+// buffer level encoder/decoder (base64.cpp) which picks AVX2, SSSE3 or
+// scalar kernels at runtime.
 
-#include <stdio.h>
-#include <stdlib.h>
+#include <stddef.h>
 
 #include <string>
 #include <iostream>
@@ -217,21 +218,59 @@ class Base64
  public:
     Base64()
     {
-        // Translation Table as described in RFC1113
-        m_cb64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                 "abcdefghijklmnopqrstuvwxyz"
-                 "0123456789+/";
+    }
 
-        // Translation Table to decode (created by author)
-        m_cd64 = "|$$$}rstuvwxyz{$$$$$$$>?@ABCDEFGHIJKLMNOPQRSTUVW$$$$$$"
-                 "XYZ[\\]^_`abcdefghijklmnopq";
+    virtual ~Base64()
+    {
+    }
 
+    /*
+    ** encodedLength
+    **
+    ** number of characters encode() produces for len input bytes.
+    */
+    static size_t encodedLength( size_t len )
+    {
+        return ((len + 2) / 3) * 4;
     }
 
-    virtual ~Base64()
+    /*
+    ** decodedMaxLength
+    **
+    ** upper bound on the number of bytes decode() produces for len
+    ** characters of input.
+    */
+    static size_t decodedMaxLength( size_t len )
     {
+        return ((len + 3) / 4) * 3;
     }
 
+    /*
+    ** encode
+    **
+    ** base64 encode len bytes of in into out, adding padding but no
+    ** line breaks.  out must hold encodedLength(len) characters.
+    ** returns the number of characters written.
+    */
+    static size_t encode( const unsigned char* in, size_t len, char* out );
+
+    /*
+    ** decode
+    **
+    ** decode len characters of in into out, discarding padding, line
+    ** breaks and noise.  out must hold decodedMaxLength(len) bytes.
+    ** returns the number of bytes written.
+    */
+    static size_t decode( const char* in, size_t len, unsigned char* out );
+
+    /*
+    ** kernel
+    **
+    ** name of the kernel selected for this cpu ("avx2", "ssse3" or
+    ** "scalar").
+    */
+    static const char* kernel();
+
     /*
     ** encode
     **
@@ -242,37 +281,56 @@ class Base64
                  std::ostream& outStr,
                  int linesize = -1 )
     {
-        unsigned char in[3], out[4];
-        int i, len, blocksout = 0;
+        // a multiple of 3 so only the final block carries padding
+        const size_t blockIn = 3 * 1024 * 4;
+        char in[blockIn];
+        char out[(blockIn / 3) * 4];
         int numRead = 0;
+        size_t lineChars = (linesize > 0) ? (size_t) ((linesize / 4) * 4) : 0;
+        size_t column = 0;
+        if( lineChars == 0 && linesize > 0 ) {
+            lineChars = 4;
+        }
 
-        while( (size > 0 && numRead < size) && inStr.good() ) {
-            len = 0;
-            for( i = 0; i < 3; i++ ) {
-                inStr.get( (char&) in[i] );
-                if( inStr.good() ) {
-                    len++;
-                    numRead++;
-                }
-                else {
-                    in[i] = 0;
-                }
+        while( (size < 0 || numRead < size) && inStr.good() ) {
+            size_t want = blockIn;
+            if( size >= 0 && (size_t) (size - numRead) < want ) {
+                want = (size_t) (size - numRead);
             }
-            if( len ) {
-                encodeblock( in, out, len );
-                for( i = 0; i < 4; i++ ) {
-                    outStr.put( out[i] );
-                }
-                blocksout++;
+            // fill the whole block so padding only lands at the end
+            size_t got = 0;
+            while( got < want && inStr.good() ) {
+                inStr.read( in + got, (std::streamsize) (want - got) );
+                got += (size_t) inStr.gcount();
+            }
+            if( got == 0 ) {
+                break;
+            }
+            numRead += (int) got;
+            size_t n = encode( (const unsigned char*) in, got, out );
+            if( lineChars == 0 ) {
+                outStr.write( out, (std::streamsize) n );
+                continue;
             }
-            if( linesize > 0 && (blocksout >= (linesize/4) || inStr.eof()) ) {
-                if( blocksout ) {
+            for( size_t i = 0; i < n; ) {
+                size_t amt = lineChars - column;
+                if( amt > n - i ) {
+                    amt = n - i;
+                }
+                outStr.write( out + i, (std::streamsize) amt );
+                i += amt;
+                column += amt;
+                if( column == lineChars ) {
                     outStr.put( '\r' );
                     outStr.put( '\n' );
+                    column = 0;
                 }
-                blocksout = 0;
             }
         }
+        if( lineChars && column ) {
+            outStr.put( '\r' );
+            outStr.put( '\n' );
+        }
     }
 
     /*
@@ -284,68 +342,50 @@ class Base64
                  int size,                // -1 means all
                  std::ostream& outStr )
     {
-        unsigned char in[4], out[3], v;
-        int i, len;
+        const size_t blockIn = 1024 * 16;
+        char in[blockIn];
+        // significant characters only, plus up to 3 carried over
+        char sig[blockIn + 3];
+        unsigned char out[((blockIn + 3) / 4) * 3];
+        size_t have = 0;
         int numRead = 0;
 
-        while( (size > 0 && numRead < size) && inStr.good() ) {
-            for( len = 0, i = 0; i < 4 && inStr.good(); i++ ) {
-                v = 0;
-                while( inStr.good() && v == 0 ) {
-                    inStr.get( (char&) v );
-                    v = (unsigned char) ((v < 43 || v > 122) ? 0 : m_cd64[ v - 43 ]);
-                    if( v ) {
-                        v = (unsigned char) ((v == '$') ? 0 : v - 61);
-                    }
-                }
-                if( inStr.good() ) {
-                    numRead++;
-                    len++;
-                    if( v ) {
-                        in[ i ] = (unsigned char) (v - 1);
-                    }
-                }
-                else {
-                    in[i] = 0;
-                }
+        while( (size < 0 || numRead < size) && inStr.good() ) {
+            size_t want = blockIn;
+            if( size >= 0 && (size_t) (size - numRead) < want ) {
+                want = (size_t) (size - numRead);
+            }
+            inStr.read( in, (std::streamsize) want );
+            size_t got = (size_t) inStr.gcount();
+            if( got == 0 ) {
+                break;
             }
-            if( len ) {
-                decodeblock( in, out );
-                for( i = 0; i < len - 1; i++ ) {
-                    outStr.put( out[i] );
+            numRead += (int) got;
+            for( size_t i = 0; i < got; i++ ) {
+                if( isSignificant( in[i] ) ) {
+                    sig[have++] = in[i];
                 }
             }
+            // decode whole quanta, carry a partial one to the next read
+            size_t whole = (have / 4) * 4;
+            size_t n = decode( sig, whole, out );
+            outStr.write( (const char*) out, (std::streamsize) n );
+            for( size_t i = whole; i < have; i++ ) {
+                sig[i - whole] = sig[i];
+            }
+            have -= whole;
+        }
+        if( have ) {
+            size_t n = decode( sig, have, out );
+            outStr.write( (const char*) out, (std::streamsize) n );
         }
     }
 
  private:
-    std::string m_cb64;
-    std::string m_cd64;
-
-    /*
-    ** encodeblock
-    **
-    ** encode 3 8-bit binary bytes as 4 '6-bit' characters
-    */
-    void encodeblock( unsigned char in[3], unsigned char out[4], int len )
+    static bool isSignificant( char c )
     {
-        out[0] = m_cb64[ in[0] >> 2 ];
-        out[1] = m_cb64[ ((in[0] & 0x03) << 4) | ((in[1] & 0xf0) >> 4) ];
-        out[2] = (unsigned char) (len > 1 ? m_cb64[ ((in[1] & 0x0f) << 2) | ((in[2] & 0xc0) >> 6) ] : '=');
-        out[3] = (unsigned char) (len > 2 ? m_cb64[ in[2] & 0x3f ] : '=');
-    }
-
-
-    /*
-    ** decodeblock
-    **
-    ** decode 4 '6-bit' characters into 3 8-bit binary bytes
-    */
-    void decodeblock( unsigned char in[4], unsigned char out[3] )
-    {   
-        out[ 0 ] = (unsigned char ) (in[0] << 2 | in[1] >> 4);
-        out[ 1 ] = (unsigned char ) (in[1] << 4 | in[2] >> 2);
-        out[ 2 ] = (unsigned char ) (((in[2] << 6) & 0xc0) | in[3]);
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
+            || (c >= '0' && c <= '9') || c == '+' || c == '/';
     }
 };
 
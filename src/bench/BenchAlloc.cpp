@@ -0,0 +1,58 @@
+/**
+ *  Counts heap allocations for the FileAccess microbenchmarks by
+ *  replacing the global operator new.  Linking this in is what makes
+ *  benchAllocations() available.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "BenchUtil.h"
+#include "Atomic.h"
+#include <new>
+#include <stdlib.h>
+
+// the exception specifications the standard library declares these with
+#if __cplusplus >= 201103L
+#define BENCH_THROWS_BAD_ALLOC
+#define BENCH_THROWS_NOTHING noexcept
+#else
+#define BENCH_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define BENCH_THROWS_NOTHING throw()
+#endif
+
+static AtomicCounter s_allocations = 0;
+
+long long
+benchAllocations()
+{
+    return atomicLoad(&s_allocations);
+}
+
+void*
+operator new(size_t size) BENCH_THROWS_BAD_ALLOC
+{
+    atomicAdd(&s_allocations, 1);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void*
+operator new[](size_t size) BENCH_THROWS_BAD_ALLOC
+{
+    return operator new(size);
+}
+
+void
+operator delete(void* p) BENCH_THROWS_NOTHING
+{
+    free(p);
+}
+
+void
+operator delete[](void* p) BENCH_THROWS_NOTHING
+{
+    free(p);
+}
@@ -0,0 +1,195 @@
+/**
+ *  A minimal blocking HTTP/1.1 client for the FileAccess benchmarks: GET
+ *  requests over a persistent connection, bodies counted and discarded.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __BENCHHTTP_H__
+#define __BENCHHTTP_H__
+
+#include <string>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+typedef SOCKET BenchSocket;
+#define closesocket_ closesocket
+#define atoll _atoi64
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int BenchSocket;
+#define INVALID_SOCKET (-1)
+#define closesocket_ ::close
+#endif
+
+struct Target {
+    std::string m_host;
+    unsigned short m_port;
+    std::string m_path;
+};
+
+/* one connection and whatever has been read from it but not consumed */
+class Connection {
+public:
+    Connection(const Target& t) : m_target(t), m_sock(INVALID_SOCKET) {
+    }
+    ~Connection() {
+        close();
+    }
+    bool connect() {
+        close();
+        m_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_sock == INVALID_SOCKET) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(m_sock, IPPROTO_TCP, TCP_NODELAY, (const char*) &one, sizeof(one));
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(m_target.m_port);
+        sa.sin_addr.s_addr = inet_addr(m_target.m_host.c_str());
+        if (::connect(m_sock, (struct sockaddr*) &sa, sizeof(sa)) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    void close() {
+        if (m_sock != INVALID_SOCKET) {
+            closesocket_(m_sock);
+            m_sock = INVALID_SOCKET;
+        }
+        m_buf.clear();
+    }
+    bool isOpen() const {
+        return m_sock != INVALID_SOCKET;
+    }
+    bool send(const std::string& s) {
+        size_t off = 0;
+        while (off < s.size()) {
+            int n = ::send(m_sock, s.data() + off, (int) (s.size() - off), 0);
+            if (n <= 0) {
+                return false;
+            }
+            off += (size_t) n;
+        }
+        return true;
+    }
+    // the response head, through the blank line
+    bool readHead(std::string& head) {
+        size_t end;
+        while ((end = m_buf.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        head = m_buf.substr(0, end + 4);
+        m_buf.erase(0, end + 4);
+        return true;
+    }
+    // discard len bytes of body, or everything up to eof if len < 0
+    bool skipBody(long long len, long long& got) {
+        got = 0;
+        for (;;) {
+            long long take = (long long) m_buf.size();
+            if (len >= 0 && take > len - got) {
+                take = len - got;
+            }
+            m_buf.erase(0, (size_t) take);
+            got += take;
+            if (len >= 0 && got == len) {
+                return true;
+            }
+            if (!fill()) {
+                return len < 0;
+            }
+        }
+    }
+private:
+    bool fill() {
+        char buf[64 * 1024];
+        int n = recv(m_sock, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return false;
+        }
+        m_buf.append(buf, (size_t) n);
+        return true;
+    }
+    const Target& m_target;
+    BenchSocket m_sock;
+    std::string m_buf;
+};
+
+/* value of header name in head, empty if absent.  name is lowercase. */
+inline std::string
+headerValue(const std::string& head, const char* name)
+{
+    std::string lower(head);
+    for (size_t i = 0; i < lower.size(); i++) {
+        lower[i] = (char) tolower((unsigned char) lower[i]);
+    }
+    std::string key = std::string("\r\n") + name + ":";
+    size_t at = lower.find(key);
+    if (at == std::string::npos) {
+        return std::string();
+    }
+    size_t start = head.find_first_not_of(" \t", at + key.size());
+    size_t end = head.find("\r\n", start);
+    return head.substr(start, end - start);
+}
+/* split an http://host:port/path url, false if it isn't one */
+inline bool
+parseUrl(const std::string& url, Target& t)
+{
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        return false;
+    }
+    size_t slash = url.find('/', scheme.size());
+    std::string hostPort = url.substr(scheme.size(), slash - scheme.size());
+    size_t colon = hostPort.find(':');
+    t.m_host = hostPort.substr(0, colon);
+    t.m_port = (unsigned short) (colon == std::string::npos ? 80 : atoi(hostPort.c_str() + colon + 1));
+    t.m_path = (slash == std::string::npos) ? "/" : url.substr(slash);
+    return !t.m_host.empty() && t.m_port != 0;
+}
+
+/* GET target's path over conn, (re)connecting as needed, and count the
+ * body into bytes.  false on error or a status other than 200 */
+inline bool
+httpGet(Connection& conn, const Target& t, long long& bytes)
+{
+    std::string request = "GET " + t.m_path + " HTTP/1.1\r\nHost: " + t.m_host + "\r\n\r\n";
+    if (!conn.isOpen() && !conn.connect()) {
+        return false;
+    }
+    std::string head;
+    if (!conn.send(request) || !conn.readHead(head)) {
+        // a kept connection may have been closed as we sent, retry once
+        if (!conn.connect() || !conn.send(request) || !conn.readHead(head)) {
+            conn.close();
+            return false;
+        }
+    }
+    std::string length = headerValue(head, "content-length");
+    if (head.size() < 12 || head.compare(9, 3, "200") != 0
+        || !conn.skipBody(length.empty() ? -1 : atoll(length.c_str()), bytes))
+    {
+        conn.close();
+        return false;
+    }
+    if (length.empty() || headerValue(head, "connection") == "close") {
+        conn.close();
+    }
+    return true;
+}
+
+#endif
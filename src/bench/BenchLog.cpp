@@ -0,0 +1,13 @@
+/**
+ *  FileServer logs through the service framework, which isn't running
+ *  under the benchmarks.  Messages are dropped.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "bpservice/bpservice.h"
+
+void
+bplus::service::Service::log(unsigned int, const std::string&)
+{
+}
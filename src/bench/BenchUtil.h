@@ -0,0 +1,94 @@
+/**
+ *  Small helpers shared by the FileAccess microbenchmarks: a wall clock,
+ *  a way to run the same function on n threads at once, percentiles of
+ *  samples and eviction of a file from the os cache.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#ifndef __BENCHUTIL_H__
+#define __BENCHUTIL_H__
+
+#include "bputil/bpthread.h"
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* seconds since an arbitrary epoch, microsecond resolution or better */
+inline double
+benchNow()
+{
+#ifdef WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double) now.QuadPart / (double) freq.QuadPart;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+#endif
+}
+
+/* run func(cookies[i]) on cookies.size() threads and wait for them all,
+ * returning the elapsed wall time */
+inline double
+benchRunThreads(bplus::thread::StartRoutine func, const std::vector<void*>& cookies)
+{
+    std::vector<bplus::thread::Thread*> threads;
+    double start = benchNow();
+    for (size_t i = 0; i < cookies.size(); i++) {
+        bplus::thread::Thread* t = new bplus::thread::Thread;
+        t->run(func, cookies[i]);
+        threads.push_back(t);
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    return benchNow() - start;
+}
+
+/* the p'th (0 to 1) of a sorted set of samples, 0 if there are none */
+inline double
+benchPercentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = (size_t) (p * (double) (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+/* drop the os's cached pages of path so that the next read of it goes
+ * to disk.  false where there's no way to ask for that */
+inline bool
+benchEvict(const char* path)
+{
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // dirty pages can't be dropped, write them back first
+    fdatasync(fd);
+    bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+/* heap allocations (operator new calls) made so far by any thread.  only
+ * available to benchmarks linked with BenchAlloc.cpp */
+long long benchAllocations();
+
+#endif
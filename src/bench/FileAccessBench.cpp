@@ -0,0 +1,340 @@
+/**
+ *  The FileAccess microbenchmark suite: the read, readBase64, slice and
+ *  chunk paths, base64 encoding on its own, and serving a getURL url
+ *  over loopback http.  Each runs on files of 1KB up to a maximum size
+ *  (growing 64x at a time, the last always the maximum itself), warm
+ *  (the file in the os cache) and cold (evicted before every operation,
+ *  linux only).
+ *
+ *  Results are one JSON document on stdout: throughput, latency
+ *  percentiles and heap allocations per operation for each benchmark,
+ *  size and cache state, meant to be kept and compared across releases.
+ *
+ *  usage: FileAccessBench [max file size] [benchmark,...]
+ *    sizes take a K, M or G suffix.  the default is 256M, 4G runs the
+ *    whole range.  benchmarks are read, readBase64, base64, slice, chunk
+ *    and http, all of them by default.
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "FileServer.h"
+#include "FileRead.h"
+#include "ParallelCopy.h"
+#include "base64.h"
+#include "BenchUtil.h"
+#include "BenchHttp.h"
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef WIN32
+#define strtoll _strtoi64
+#endif
+
+// time spent on each benchmark, size and cache state, within the bounds
+// on the number of operations
+#define BENCH_SECONDS 1.0
+#define BENCH_MIN_OPS 3
+#define BENCH_MAX_OPS 1000
+
+// most bytes base64 encoded per operation, it works from memory
+#define BENCH_MAX_ENCODE (64 * 1024 * 1024)
+
+// chunk size given to getFileChunks, chunk's default
+#define BENCH_CHUNK_SIZE (1 << 21)
+
+struct Fixture {
+    boost::filesystem::path m_path;
+    long long m_size;
+    Target m_target;
+    bool m_served;
+};
+
+struct Context {
+    FileServer* m_fs;
+    Connection* m_conn;
+    std::vector<unsigned char> m_memory;
+};
+
+/* one operation on f, adding the bytes it covered to bytes.  false with
+ * err set on failure */
+typedef bool (*BenchOp)(Context& ctx, const Fixture& f, long long& bytes, std::string& err);
+
+struct Benchmark {
+    const char* m_name;
+    BenchOp m_op;
+    /* whether a cold cache means anything, false for work from memory */
+    bool m_cold;
+};
+
+// the whole file in windows of the largest read a page can ask for
+static bool
+readWindows(const Fixture& f, bool base64, long long& bytes, std::string& err)
+{
+    size_t window = FA_MAX_READ;
+    if (base64) {
+        window -= window % 3;
+    }
+    FileContents contents;
+    for (long long off = 0; off < f.m_size; off += (long long) window) {
+        if (!readFileContents(f.m_path, off, (long long) window, base64, contents, err)) {
+            return false;
+        }
+        bytes += (long long) contents.length();
+    }
+    return true;
+}
+
+static bool
+benchRead(Context&, const Fixture& f, long long& bytes, std::string& err)
+{
+    return readWindows(f, false, bytes, err);
+}
+
+static bool
+benchReadBase64(Context&, const Fixture& f, long long& bytes, std::string& err)
+{
+    return readWindows(f, true, bytes, err);
+}
+
+static bool
+benchBase64(Context& ctx, const Fixture& f, long long& bytes, std::string&)
+{
+    size_t len = (size_t) std::min(f.m_size, (long long) BENCH_MAX_ENCODE);
+    if (ctx.m_memory.size() < len) {
+        ctx.m_memory.resize(len, 'x');
+    }
+    std::string out;
+    out.resize(Base64::encodedLength(len));
+    Base64::encode(&ctx.m_memory[0], len, &out[0]);
+    bytes += (long long) len;
+    return true;
+}
+
+static bool
+benchSlice(Context& ctx, const Fixture& f, long long& bytes, std::string& err)
+{
+    // all but the first byte, the whole file comes back without a copy
+    try {
+        boost::filesystem::path s = ctx.m_fs->getSlice(f.m_path, 1, f.m_size - 1);
+        ctx.m_fs->releaseTempFile(s);
+    } catch (const std::string& e) {
+        err = e;
+        return false;
+    }
+    bytes += f.m_size - 1;
+    return true;
+}
+
+static bool
+benchChunk(Context& ctx, const Fixture& f, long long& bytes, std::string& err)
+{
+    try {
+        std::vector<ChunkInfo> v = ctx.m_fs->getFileChunks(f.m_path, BENCH_CHUNK_SIZE);
+        // released so the next operation doesn't get the cached result
+        for (size_t i = 0; i < v.size(); i++) {
+            ctx.m_fs->releaseTempFile(v[i].m_path);
+        }
+    } catch (const std::string& e) {
+        err = e;
+        return false;
+    }
+    bytes += f.m_size;
+    return true;
+}
+
+static bool
+benchHttp(Context& ctx, const Fixture& f, long long& bytes, std::string& err)
+{
+    if (!f.m_served) {
+        err = "server not running";
+        return false;
+    }
+    long long got = 0;
+    if (!httpGet(*ctx.m_conn, f.m_target, got) || got != f.m_size) {
+        err = "request failed";
+        return false;
+    }
+    bytes += got;
+    return true;
+}
+
+static const Benchmark s_benchmarks[] = {
+    { "read", benchRead, true },
+    { "readBase64", benchReadBase64, true },
+    { "base64", benchBase64, false },
+    { "slice", benchSlice, true },
+    { "chunk", benchChunk, true },
+    { "http", benchHttp, true },
+    { NULL, NULL, false }
+};
+
+static long long
+parseSize(const char* s)
+{
+    char* end = NULL;
+    long long n = strtoll(s, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': return n << 10;
+        case 'm': case 'M': return n << 20;
+        case 'g': case 'G': return n << 30;
+    }
+    return n;
+}
+
+// a text file of size bytes at path, reusing one left by an earlier run
+static bool
+makeFixture(const boost::filesystem::path& path, long long size)
+{
+    NativeFile f;
+    if (f.openRead(path) && f.size() == size) {
+        return true;
+    }
+    if (!f.openWrite(path)) {
+        return false;
+    }
+    std::string block;
+    const char* line = "The quick brown fox jumps over the lazy dog, 0123456789.\n";
+    while (block.size() < (1 << 20)) {
+        block += line;
+    }
+    for (long long off = 0; off < size; off += (long long) block.size()) {
+        size_t len = (size_t) std::min((long long) block.size(), size - off);
+        if (f.writeAt(block.data(), len, off) != (long long) len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+printResult(bool& first, const Benchmark& b, const Fixture& f, bool cold,
+            std::vector<double>& latencies, double elapsed, long long bytes,
+            long long allocs, const std::string& err)
+{
+    printf("%s  {\"name\": \"%s\", \"size\": %lld, \"cache\": \"%s\"",
+           first ? "" : ",\n", b.m_name, f.m_size, cold ? "cold" : "warm");
+    first = false;
+    if (!err.empty()) {
+        printf(", \"error\": \"%s\"}", err.c_str());
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double ops = (double) latencies.size();
+    printf(", \"ops\": %lu, \"mb_per_sec\": %.1f, \"ops_per_sec\": %.1f, "
+           "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"allocs_per_op\": %.1f}",
+           (unsigned long) latencies.size(), (double) bytes / elapsed / (1024.0 * 1024.0),
+           ops / elapsed, benchPercentile(latencies, 0.50) * 1000.0,
+           benchPercentile(latencies, 0.90) * 1000.0, benchPercentile(latencies, 0.99) * 1000.0,
+           (double) allocs / ops);
+    fflush(stdout);
+}
+
+static void
+runBenchmark(Context& ctx, const Benchmark& b, const Fixture& f, bool cold, bool& first)
+{
+    std::vector<double> latencies;
+    std::string err;
+    long long bytes = 0, allocs = 0;
+    double elapsed = 0;
+    // one untimed operation so a warm run starts warm
+    if (!cold) {
+        long long ignored = 0;
+        b.m_op(ctx, f, ignored, err);
+    }
+    size_t minOps = (f.m_size >= (1LL << 30)) ? 1 : BENCH_MIN_OPS;
+    while (err.empty() && latencies.size() < BENCH_MAX_OPS
+           && (latencies.size() < minOps || elapsed < BENCH_SECONDS))
+    {
+        if (cold) {
+            benchEvict(f.m_path.string().c_str());
+        }
+        long long a = benchAllocations();
+        double start = benchNow();
+        if (!b.m_op(ctx, f, bytes, err)) {
+            break;
+        }
+        double t = benchNow() - start;
+        allocs += benchAllocations() - a;
+        latencies.push_back(t);
+        elapsed += t;
+    }
+    printResult(first, b, f, cold, latencies, elapsed, bytes, allocs, err);
+}
+
+int
+main(int argc, char** argv)
+{
+    long long maxSize = (argc > 1) ? parseSize(argv[1]) : (256LL << 20);
+    std::string only = (argc > 2) ? "," + std::string(argv[2]) + "," : std::string();
+#ifdef WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+    boost::filesystem::path dataDir("FileAccessBench.data");
+    boost::filesystem::create_directories(dataDir);
+    FileServer fs(boost::filesystem::path("FileAccessBench.tmp"));
+    // the service's temp limits would fail slice and chunk of the larger
+    // files, there's room for the biggest one's worth here
+    MetricsSnapshot limits;
+    fs.stats(limits);
+    long long tempFiles = maxSize / BENCH_CHUNK_SIZE + 1;
+    long long tempBytes = maxSize;
+    if (tempFiles < limits.m_tempFileLimit) tempFiles = limits.m_tempFileLimit;
+    if (tempBytes < limits.m_tempByteLimit) tempBytes = limits.m_tempByteLimit;
+    fs.setTempLimits((size_t) tempFiles, (size_t) tempBytes);
+    bool serving = !fs.start().empty();
+    Context ctx;
+    ctx.m_fs = &fs;
+
+    std::vector<Fixture> fixtures;
+    // the steps needn't land on the maximum, it's always included
+    std::vector<long long> sizes;
+    for (long long size = 1024; size < maxSize; size *= 64) {
+        sizes.push_back(size);
+    }
+    if (maxSize > 0) {
+        sizes.push_back(maxSize);
+    }
+    for (size_t i = 0; i < sizes.size(); i++) {
+        long long size = sizes[i];
+        Fixture f;
+        std::stringstream name;
+        name << "file-" << size << ".txt";
+        f.m_path = dataDir / name.str();
+        f.m_size = size;
+        if (!makeFixture(f.m_path, size)) {
+            fprintf(stderr, "couldn't create %s\n", f.m_path.string().c_str());
+            return 1;
+        }
+        f.m_served = serving && parseUrl(fs.addFile(f.m_path, 0, -1, 0, 0), f.m_target);
+        fixtures.push_back(f);
+    }
+    bool canEvict = !fixtures.empty() && benchEvict(fixtures[0].m_path.string().c_str());
+
+    printf("{\"suite\": \"FileAccess\", \"processors\": %u, \"base64_kernel\": \"%s\", "
+           "\"cold_cache\": %s, \"results\": [\n",
+           processorCount(), Base64::kernel(), canEvict ? "true" : "false");
+    bool first = true;
+    for (size_t i = 0; i < fixtures.size(); i++) {
+        // one connection per file, all of its requests kept alive on it
+        Connection fileConn(fixtures[i].m_target);
+        ctx.m_conn = &fileConn;
+        for (const Benchmark* b = s_benchmarks; b->m_name; b++) {
+            if (!only.empty() && only.find("," + std::string(b->m_name) + ",") == std::string::npos) {
+                continue;
+            }
+            runBenchmark(ctx, *b, fixtures[i], false, first);
+            if (b->m_cold && canEvict) {
+                runBenchmark(ctx, *b, fixtures[i], true, first);
+            }
+        }
+    }
+    printf("\n]}\n");
+    return 0;
+}
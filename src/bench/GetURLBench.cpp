@@ -0,0 +1,98 @@
+/**
+ *  Load on a url handed out by getURL: throughput and latency of whole
+ *  file downloads as the number of concurrent clients grows.  Each
+ *  client downloads over one persistent connection, reconnecting when
+ *  the server closes it.
+ *
+ *  The server's concurrency settings (threads, sendWindow, ioBuffer,
+ *  keepAliveRequests, ...) come from server.conf in the service's data
+ *  directory.  To see how one responds, change it, restart the service,
+ *  get a fresh url and run this again.
+ *
+ *  usage: GetURLBench url [requests per client] [max clients]
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "BenchUtil.h"
+#include "BenchHttp.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct ClientArgs {
+    const Target* m_target;
+    size_t m_requests;
+    std::vector<double> m_latencies;
+    long long m_bytes;
+    size_t m_errors;
+};
+
+static void*
+client(void* cookie)
+{
+    ClientArgs* args = (ClientArgs*) cookie;
+    Connection conn(*args->m_target);
+    for (size_t i = 0; i < args->m_requests; i++) {
+        double start = benchNow();
+        long long got = 0;
+        if (!httpGet(conn, *args->m_target, got)) {
+            args->m_errors++;
+            continue;
+        }
+        args->m_latencies.push_back(benchNow() - start);
+        args->m_bytes += got;
+    }
+    return NULL;
+}
+
+int
+main(int argc, char** argv)
+{
+    Target target;
+    if (argc < 2 || !parseUrl(argv[1], target)) {
+        fprintf(stderr, "usage: %s url [requests per client] [max clients]\n", argv[0]);
+        return 1;
+    }
+    size_t requests = (argc > 2) ? (size_t) atol(argv[2]) : 200;
+    size_t maxClients = (argc > 3) ? (size_t) atol(argv[3]) : 32;
+#ifdef WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+    printf("{\"benchmark\": \"getURL\", \"url\": \"%s\", \"results\": [\n", argv[1]);
+    for (size_t n = 1; n <= maxClients; n *= 2) {
+        std::vector<ClientArgs> clients(n);
+        std::vector<void*> cookies;
+        for (size_t i = 0; i < n; i++) {
+            clients[i].m_target = &target;
+            clients[i].m_requests = requests;
+            clients[i].m_bytes = 0;
+            clients[i].m_errors = 0;
+            cookies.push_back(&clients[i]);
+        }
+        double elapsed = benchRunThreads(client, cookies);
+        std::vector<double> latencies;
+        long long bytes = 0;
+        size_t errors = 0;
+        for (size_t i = 0; i < n; i++) {
+            latencies.insert(latencies.end(), clients[i].m_latencies.begin(),
+                             clients[i].m_latencies.end());
+            bytes += clients[i].m_bytes;
+            errors += clients[i].m_errors;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        printf("  {\"clients\": %lu, \"requests_per_sec\": %.1f, \"mb_per_sec\": %.1f, "
+               "\"p50_ms\": %.2f, \"p99_ms\": %.2f, \"errors\": %lu}%s\n",
+               (unsigned long) n, (double) latencies.size() / elapsed,
+               (double) bytes / elapsed / (1024.0 * 1024.0),
+               benchPercentile(latencies, 0.50) * 1000.0, benchPercentile(latencies, 0.99) * 1000.0,
+               (unsigned long) errors, (n * 2 <= maxClients) ? "," : "");
+        fflush(stdout);
+    }
+    printf("]}\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ *  Lookup throughput of the FileServer token table as the number of
+ *  concurrent reader threads grows, with one thread registering new
+ *  tokens in the background the way getURL does.
+ *
+ *  usage: TokenTableBench [tokens] [lookups per thread] [max threads]
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "TokenTable.h"
+#include "BenchUtil.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+struct ReaderArgs {
+    TokenTable* m_table;
+    const std::vector<Token>* m_tokens;
+    size_t m_lookups;
+    size_t m_seed;
+    size_t m_found;
+};
+
+struct WriterArgs {
+    TokenTable* m_table;
+    size_t m_inserts;
+};
+
+static Token
+makeToken(size_t i)
+{
+    char buf[37];
+    sprintf(buf, "%08lx-%04lx-4000-8000-%012lx",
+            (unsigned long) (i * 2654435761UL) & 0xffffffffUL,
+            (unsigned long) (i >> 3) & 0xffff,
+            (unsigned long) i);
+    Token t;
+    Token::parse(buf, t);
+    return t;
+}
+
+static void*
+reader(void* cookie)
+{
+    ReaderArgs* args = (ReaderArgs*) cookie;
+    const std::vector<Token>& tokens = *args->m_tokens;
+    ServedFile sf;
+    size_t idx = args->m_seed;
+    // counted locally, the args of neighbouring threads share cache lines
+    size_t found = 0;
+    for (size_t i = 0; i < args->m_lookups; i++) {
+        idx = (idx * 1103515245 + 12345) % tokens.size();
+        if (args->m_table->find(tokens[idx], sf)) {
+            found++;
+        }
+    }
+    args->m_found = found;
+    return NULL;
+}
+
+static void*
+writer(void* cookie)
+{
+    WriterArgs* args = (WriterArgs*) cookie;
+    ServedFile sf;
+    sf.m_path = "/tmp/bench";
+    sf.m_offset = 0;
+    sf.m_size = -1;
+    for (size_t i = 0; i < args->m_inserts; i++) {
+        args->m_table->insert(makeToken(1000000000 + i), sf);
+    }
+    return NULL;
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t numTokens = (argc > 1) ? (size_t) atol(argv[1]) : 10000;
+    size_t lookups = (argc > 2) ? (size_t) atol(argv[2]) : 1000000;
+    size_t maxThreads = (argc > 3) ? (size_t) atol(argv[3]) : 16;
+
+    TokenTable table;
+    std::vector<Token> tokens;
+    ServedFile sf;
+    sf.m_path = "/tmp/bench";
+    sf.m_offset = 0;
+    sf.m_size = -1;
+    for (size_t i = 0; i < numTokens; i++) {
+        tokens.push_back(makeToken(i));
+        table.insert(tokens.back(), sf);
+    }
+
+    printf("{\"benchmark\": \"TokenTable.find\", \"tokens\": %lu, \"results\": [\n",
+           (unsigned long) numTokens);
+    for (size_t n = 1; n <= maxThreads; n *= 2) {
+        std::vector<ReaderArgs> readers(n);
+        std::vector<void*> cookies;
+        for (size_t i = 0; i < n; i++) {
+            readers[i].m_table = &table;
+            readers[i].m_tokens = &tokens;
+            readers[i].m_lookups = lookups;
+            readers[i].m_seed = i * 7919;
+            readers[i].m_found = 0;
+            cookies.push_back(&readers[i]);
+        }
+        // one registering thread alongside the readers
+        WriterArgs w = { &table, lookups / 100 };
+        bplus::thread::Thread wt;
+        wt.run(writer, &w);
+        double elapsed = benchRunThreads(reader, cookies);
+        wt.join();
+        double opsPerSec = (double) (n * lookups) / elapsed;
+        printf("  {\"threads\": %lu, \"lookups_per_sec\": %.0f, \"per_thread\": %.0f}%s\n",
+               (unsigned long) n, opsPerSec, opsPerSec / (double) n,
+               (n * 2 <= maxThreads) ? "," : "");
+    }
+    printf("]}\n");
+    return 0;
+}
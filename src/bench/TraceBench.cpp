@@ -0,0 +1,173 @@
+/**
+ *  The cost of a trace event, with tracing off and on, from one thread
+ *  and from several recording into the shared buffer at once.  Before
+ *  timing anything the dump is checked against the events recorded: the
+ *  lines and their fields, the oldest dropped once the buffer wraps, and
+ *  tokens written only as a hash.  A mismatch is reported on stderr and
+ *  fails the run.
+ *
+ *  usage: TraceBench [events per thread] [max threads]
+ *
+ *  (c) 2010 Yahoo! inc.
+ */
+
+#include "Trace.h"
+#include "BenchUtil.h"
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// the buffer size the dump checks are written against
+#define TB_EVENTS 64
+
+struct RecorderArgs {
+    const Token* m_token;
+    size_t m_events;
+};
+
+static void*
+recorder(void* cookie)
+{
+    RecorderArgs* args = (RecorderArgs*) cookie;
+    for (size_t i = 0; i < args->m_events; i++) {
+        Trace::record("http", "done", args->m_token, 200, (long long) i, 0);
+    }
+    return NULL;
+}
+
+static std::vector<std::string>
+dumpLines()
+{
+    std::stringstream ss;
+    Trace::dump(ss);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(ss, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/* fields of an event line: time thread name stage token status bytes micros */
+static std::vector<std::string>
+fields(const std::string& line)
+{
+    std::stringstream ss(line);
+    std::vector<std::string> f;
+    std::string s;
+    while (ss >> s) {
+        f.push_back(s);
+    }
+    return f;
+}
+
+static bool
+check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "trace check failed: %s\n", what);
+    }
+    return ok;
+}
+
+static bool
+checkDump(const Token& a, const char* aText, const Token& b)
+{
+    bool ok = true;
+    // off: nothing is kept, the dump is the header alone
+    Trace::record("read", "done", NULL, 0, 10, 1);
+    std::vector<std::string> lines = dumpLines();
+    ok &= check(lines.size() == 2, "events recorded while tracing is off");
+    ok &= check(lines.size() > 1 && lines[0].compare(0, 21, "# FileAccess trace at") == 0
+                && lines[1] == "# time thread name stage token status bytes micros",
+                "header");
+
+    Trace::configure(Trace::Requests, 1, TB_EVENTS);
+    Trace::record("read", "done", NULL, 0, 10, 1);
+    Trace::record("http", "done", &a, 200, 2048, 35);
+    Trace::record("http", "status", &a, 206, 0, 7);
+    Trace::record("http", "done", &b, 404, 0, 3);
+    lines = dumpLines();
+    if (!check(lines.size() == 6, "one line per event")) {
+        return false;
+    }
+    std::vector<std::string> f[4];
+    for (size_t i = 0; i < 4; i++) {
+        f[i] = fields(lines[i + 2]);
+        ok &= check(f[i].size() == 8, "eight fields to an event");
+        if (f[i].size() != 8) {
+            return false;
+        }
+    }
+    ok &= check(f[0][2] == "read" && f[0][3] == "done" && f[0][4] == "-"
+                && f[0][5] == "0" && f[0][6] == "10" && f[0][7] == "1",
+                "an event without a token");
+    ok &= check(f[1][2] == "http" && f[1][3] == "done" && f[1][5] == "200"
+                && f[1][6] == "2048" && f[1][7] == "35", "an event with a token");
+    ok &= check(f[2][3] == "status" && f[2][5] == "206", "events in order");
+    ok &= check(atoll(f[0][0].c_str()) <= atoll(f[3][0].c_str()), "times in order");
+    // the same token hashes the same, a different one differently, and
+    // the token itself is nowhere
+    ok &= check(f[1][4].size() == 8 && f[1][4].find_first_not_of("0123456789abcdef")
+                == std::string::npos, "tokens as 8 hex digits");
+    ok &= check(f[1][4] == f[2][4], "a token hashes the same each time");
+    ok &= check(f[1][4] != f[3][4], "different tokens hash differently");
+    for (size_t i = 2; i < lines.size(); i++) {
+        ok &= check(lines[i].find(aText) == std::string::npos, "a token in full");
+    }
+
+    // once the buffer wraps, the newest TB_EVENTS are what's left
+    for (long long i = 0; i < 3 * TB_EVENTS; i++) {
+        Trace::record("read", "done", NULL, 0, i, 0);
+    }
+    lines = dumpLines();
+    ok &= check(lines.size() == TB_EVENTS + 2, "a full buffer");
+    if (lines.size() == TB_EVENTS + 2) {
+        for (size_t i = 0; i < TB_EVENTS; i++) {
+            std::vector<std::string> e = fields(lines[i + 2]);
+            ok &= check(e.size() == 8 && atoll(e[6].c_str()) == (long long) (2 * TB_EVENTS + i),
+                        "the oldest events dropped");
+        }
+    }
+    return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t events = (argc > 1) ? (size_t) atol(argv[1]) : 1000000;
+    size_t maxThreads = (argc > 2) ? (size_t) atol(argv[2]) : 16;
+
+    const char* aText = "6ba7b810-9dad-11d1-80b4-00c04fd430c8";
+    Token a, b;
+    Token::parse(aText, a);
+    Token::parse("6ba7b811-9dad-11d1-80b4-00c04fd430c8", b);
+    if (!checkDump(a, aText, b)) {
+        return 1;
+    }
+
+    printf("{\"benchmark\": \"Trace.record\", \"buffer\": %d, \"results\": [\n", TB_EVENTS);
+    // off first, then on: the buffer can't be taken away once it's there
+    Trace::configure(Trace::Off, 1, TB_EVENTS);
+    RecorderArgs args = { &a, events };
+    double start = benchNow();
+    recorder(&args);
+    printf("  {\"tracing\": \"off\", \"threads\": 1, \"ns_per_event\": %.1f},\n",
+           (benchNow() - start) * 1e9 / (double) events);
+    Trace::configure(Trace::Requests, 1, TB_EVENTS);
+    for (size_t n = 1; n <= maxThreads; n *= 2) {
+        std::vector<RecorderArgs> recorders(n, args);
+        std::vector<void*> cookies;
+        for (size_t i = 0; i < n; i++) {
+            cookies.push_back(&recorders[i]);
+        }
+        double elapsed = benchRunThreads(recorder, cookies);
+        printf("  {\"tracing\": \"on\", \"threads\": %lu, \"ns_per_event\": %.1f}%s\n",
+               (unsigned long) n, elapsed * 1e9 / (double) (n * events),
+               (n * 2 <= maxThreads) ? "," : "");
+    }
+    printf("]}\n");
+    return 0;
+}
@@ -1,17 +1,236 @@
 #include "bpservice/bpservice.h"
 #include "bpservice/bpcallback.h"
 #include "FileServer.h"
-#include "base64.h"
+#include "FileIO.h"
+#include "FileRead.h"
+#include "TextScan.h"
+#include "Digest.h"
+#include "ParallelCopy.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <fstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
-// 2mb is max allowable read
-#define FA_MAX_READ (1<<21)
+// default block size for readStream
+#define FA_STREAM_BLOCK (1<<18)
 
 // 2mb is default chunk size
 #define FA_CHUNK_SIZE (1<<21)
+
+#ifdef WIN32
+#define strtoll _strtoi64
+#endif
+
+// optional settings for the http server, in the service's data dir
+#define FA_SERVER_CONFIG "server.conf"
+
+// where the trace buffer is written when the service goes away, in the
+// data dir, and the number of events it holds by default
+#define FA_TRACE_DUMP "trace.txt"
+#define FA_TRACE_EVENTS 4096
+
+// most entries in one readMany or chunkMany
+#define FA_MAX_BATCH 1024
+
+// 16mb is the most one readMany returns, across all of its entries
+#define FA_MAX_BATCH_READ (1<<24)
+
+// files read at once by readMany, and chunked at once by chunkMany (each
+// of which writes its chunks in parallel already)
+#define FA_READ_BATCH_THREADS 8
+#define FA_CHUNK_BATCH_THREADS 4
+
+
+// digest name -> hex as a map for the page
+static bplus::Map*
+digestMap(const std::map<std::string, std::string>& digests)
+{
+    bplus::Map* m = new bplus::Map;
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = digests.begin(); it != digests.end(); ++it) {
+        m->add(it->first, new bplus::String(it->second));
+    }
+    return m;
+}
+
+// the return value's representation of a chunk
+static bplus::Object*
+chunkObject(const ChunkInfo& c, bool isVirtual, bool withDigests)
+{
+    if (!isVirtual && !withDigests) {
+        return new bplus::Path(bp::file::nativeString(c.m_path));
+    }
+    bplus::Map* m = new bplus::Map;
+    m->add("file", new bplus::Path(bp::file::nativeString(c.m_path)));
+    if (isVirtual) {
+        m->add("offset", new bplus::Integer(c.m_offset));
+        m->add("size", new bplus::Integer(c.m_size));
+    }
+    if (withDigests) {
+        m->add("digests", digestMap(c.m_digests));
+    }
+    return m;
+}
+
+// the mask of Digest::Algorithm named by the list of strings args[key],
+// false with err set if any name is unknown
+static bool
+parseDigests(const bplus::Map& args, const char* key, unsigned int& mask, std::string& err)
+{
+    mask = 0;
+    const bplus::List* names = dynamic_cast<const bplus::List*>(args.value(key));
+    if (!names) {
+        return true;
+    }
+    for (unsigned int i = 0; i < names->size(); i++) {
+        const bplus::String* name = dynamic_cast<const bplus::String*>(names->value(i));
+        Digest::Algorithm a;
+        if (!name || !Digest::parse((std::string) *name, a)) {
+            err = "unsupported digest, use md5, sha1, sha256 or crc32";
+            return false;
+        }
+        mask |= a;
+    }
+    return true;
+}
+
+// apply the "name = value" lines of the config file at path to fs.  all
+// values are non-negative integers (booleans are 0 or 1), lines starting
+// with # are comments.  a missing file leaves the defaults be.
+static void
+configureServer(FileServer& fs, const boost::filesystem::path& path)
+{
+    std::ifstream in(path.string().c_str());
+    if (!in) {
+        return;
+    }
+    long long keepAliveTimeout = -1, keepAliveRequests = -1;
+    long long compress = -1, compressCache = -1;
+    long long sendWindow = 0, ioBuffer = 0;
+    long long traceLevel = 0, traceSample = 1, traceEvents = FA_TRACE_EVENTS;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t eq = line.find('=');
+        if (line.empty() || line[0] == '#' || eq == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, eq);
+        name.erase(name.find_last_not_of(" \t") + 1);
+        name.erase(0, name.find_first_not_of(" \t"));
+        char* end = NULL;
+        long long value = strtoll(line.c_str() + eq + 1, &end, 10);
+        if (value < 0 || end == line.c_str() + eq + 1) {
+            bplus::service::Service::log(BP_WARN, "bad value in " FA_SERVER_CONFIG ": " + line);
+            continue;
+        }
+        if (name == "threads") {
+            fs.setThreads((unsigned int) value);
+        } else if (name == "sendWindow") {
+            sendWindow = value;
+        } else if (name == "ioBuffer") {
+            ioBuffer = value;
+        } else if (name == "keepAliveTimeout") {
+            keepAliveTimeout = value;
+        } else if (name == "keepAliveRequests") {
+            keepAliveRequests = value;
+        } else if (name == "compress") {
+            compress = value;
+        } else if (name == "compressCache") {
+            compressCache = value;
+        } else if (name == "traceLevel") {
+            traceLevel = value;
+        } else if (name == "traceSample") {
+            traceSample = value;
+        } else if (name == "traceEvents") {
+            traceEvents = value;
+        } else {
+            bplus::service::Service::log(BP_WARN, "unknown setting in " FA_SERVER_CONFIG ": " + name);
+            continue;
+        }
+        bplus::service::Service::log(BP_INFO, "server setting: " + line);
+    }
+    fs.setSendSizes((size_t) sendWindow, (size_t) ioBuffer);
+    if (keepAliveTimeout >= 0 || keepAliveRequests >= 0) {
+        fs.setKeepAlive(keepAliveTimeout >= 0 ? (unsigned int) keepAliveTimeout : fs.keepAliveTimeout(),
+                        keepAliveRequests >= 0 ? (unsigned int) keepAliveRequests : fs.keepAliveRequests());
+    }
+    if (compress >= 0 || compressCache >= 0) {
+        // either one left out stays on, as by default
+        fs.setCompression(compress != 0, compressCache != 0);
+    }
+    if (traceLevel > 0) {
+        Trace::configure(traceLevel > 1 ? Trace::Stages : Trace::Requests,
+                         (unsigned int) traceSample, (size_t) traceEvents);
+    }
+}
+
+// passes chunks to the page's callback as they become ready
+class ChunkCallback : public ChunkListener {
+public:
+    ChunkCallback(const bplus::service::Transaction& tran, const bplus::Object& cb,
+                  bool isVirtual, bool withDigests) :
+        m_cb(tran, cb), m_virtual(isVirtual), m_digests(withDigests) {
+    }
+    virtual void chunkReady(const ChunkInfo& c) {
+        bplus::Map m;
+        m.add("chunk", chunkObject(c, m_virtual, m_digests));
+        m.add("chunkNumber", new bplus::Integer((long long) c.m_chunkNumber));
+        m.add("numberOfChunks", new bplus::Integer((long long) c.m_numberOfChunks));
+        m_cb.invoke(m);
+    }
+private:
+    bplus::service::Callback m_cb;
+    bool m_virtual;
+    bool m_digests;
+};
+
+// times a service method (the whole of it, callbacks and all) into the
+// server's metrics, and traces the call if it's sampled
+class MethodTimer {
+public:
+    MethodTimer(FileServer* fs, const char* method) :
+        m_fs(fs), m_method(method), m_start(metricsNow()), m_traced(Trace::sample()) {
+        if (m_traced && Trace::enabled(Trace::Stages)) {
+            Trace::record(m_method, "start", NULL, 0, 0, 0);
+        }
+    }
+    ~MethodTimer() {
+        long long elapsed = metricsNow() - m_start;
+        m_fs->metrics().recordMethod(m_method, elapsed);
+        if (m_traced) {
+            Trace::record(m_method, "done", NULL, 0, 0, elapsed);
+        }
+    }
+private:
+    FileServer* m_fs;
+    const char* m_method;
+    long long m_start;
+    bool m_traced;
+};
+
+// the methods timed, all of them
+static const char* s_timedMethods[] = {
+    "read", "readBase64", "readStream", "slice", "getURL", "chunk", "hash",
+    "readMany", "chunkMany", "revokeURL", "release", "stats", NULL
+};
+
+static bplus::Map*
+latencyMap(const LatencySummary& l)
+{
+    bplus::Map* m = new bplus::Map;
+    m->add("count", new bplus::Integer(l.m_count));
+    m->add("totalMicros", new bplus::Integer(l.m_total));
+    m->add("maxMicros", new bplus::Integer(l.m_max));
+    m->add("p50Micros", new bplus::Integer(l.m_p50));
+    m->add("p90Micros", new bplus::Integer(l.m_p90));
+    m->add("p99Micros", new bplus::Integer(l.m_p99));
+    m->add("p999Micros", new bplus::Integer(l.m_p999));
+    return m;
+}
+
 class FileAccess : public bplus::service::Service {
 public:
 BP_SERVICE(FileAccess)
@@ -20,14 +239,18 @@ BP_SERVICE(FileAccess)
     virtual void finalConstruct();
     void read(const bplus::service::Transaction& tran, const bplus::Map& args);
     void readBase64(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void readStream(const bplus::service::Transaction& tran, const bplus::Map& args);
     void slice(const bplus::service::Transaction& tran, const bplus::Map& args);
     void getURL(const bplus::service::Transaction& tran, const bplus::Map& args);
     void chunk(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void hash(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void readMany(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void chunkMany(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void revokeURL(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void release(const bplus::service::Transaction& tran, const bplus::Map& args);
+    void stats(const bplus::service::Transaction& tran, const bplus::Map& args);
 private:
     void readImpl(const bplus::service::Transaction& tran, const bplus::Map& args, bool base64);
-    bool hasEmbeddedNulls(unsigned char* bytes, unsigned int len);
-    bplus::String* readFileContents(const boost::filesystem::path& path, unsigned int offset, int size, bool base64, std::string& err);
-private:
     FileServer* m_fs;
 };
 
@@ -51,6 +274,30 @@ ADD_BP_METHOD_ARG(readBase64, "offset", Integer, false,
                   "The beginning byte offset.")
 ADD_BP_METHOD_ARG(readBase64, "size", Integer, false,
                   "The amount of data.")
+ADD_BP_METHOD(FileAccess, readStream,
+              "Read a file of any size, handing it to a callback a block at a "
+              "time.  The file is opened once and each block is read only after "
+              "the previous one has been passed on.  Completes with the number "
+              "of bytes of the file that were delivered.")
+ADD_BP_METHOD_ARG(readStream, "file", Path, true,
+                  "The file to read.")
+ADD_BP_METHOD_ARG(readStream, "callback", CallBack, true,
+                  "Invoked for each block, in order, with an object with 'data' "
+                  "(a string), 'offset' and 'size' (the range of the file the "
+                  "block covers) keys.")
+ADD_BP_METHOD_ARG(readStream, "offset", Integer, false,
+                  "The beginning byte offset.")
+ADD_BP_METHOD_ARG(readStream, "size", Integer, false,
+                  "The number of bytes to read.  Default is through the end of "
+                  "the file.")
+ADD_BP_METHOD_ARG(readStream, "blockSize", Integer, false,
+                  "Bytes of the file per block, not to exceed 2MB.  Default is 256KB.  "
+                  "Text blocks are cut short to end on a character boundary, base64 "
+                  "blocks are rounded down to a multiple of 3 so that the encoded "
+                  "blocks may simply be concatenated.")
+ADD_BP_METHOD_ARG(readStream, "base64", Boolean, false,
+                  "If true, blocks are base64 encoded and may contain any data, "
+                  "otherwise the file must be UTF-8 text.  Default is false.")
 ADD_BP_METHOD(FileAccess, slice,
               "Given a file and an optional offset and size, return a new "
               "file whose contents are a subset of the first.")
@@ -68,9 +315,23 @@ ADD_BP_METHOD(FileAccess, getURL,
               "client accesses the URL, the FileAccess service will ignore any "
               "appended pathing (i.e. for http://127.0.0.1:<port>/<uuid>/foo.tar.gz,"
               " '/foo.tar.gz' will be ignored).  This allows client code to supply "
-              "a filename when triggering a browser supplied 'save as' dialog.")
+              "a filename when triggering a browser supplied 'save as' dialog.  "
+              "Single byte range requests (Range: bytes=a-b) are honored with "
+              "a 206 Partial Content response.")
 ADD_BP_METHOD_ARG(getURL, "file", Path, true,
                   "The file that you would like to read via a localhost url.")
+ADD_BP_METHOD_ARG(getURL, "offset", Integer, false,
+                  "Restrict the url to the portion of the file beginning at "
+                  "this byte offset.  Default is 0.")
+ADD_BP_METHOD_ARG(getURL, "size", Integer, false,
+                  "Restrict the url to this many bytes of the file.  Default "
+                  "is the remainder of the file.")
+ADD_BP_METHOD_ARG(getURL, "idleTimeout", Integer, false,
+                  "Seconds the url stays valid without being requested.  0 means "
+                  "forever.  Default is 12 hours.")
+ADD_BP_METHOD_ARG(getURL, "lifetime", Integer, false,
+                  "Seconds the url stays valid in total.  0 (the default) means "
+                  "forever.")
 ADD_BP_METHOD(FileAccess, chunk,
               "Get a vector of objects that result from chunking a file. "
               "The return value will be an ordered list of file handles with each "
@@ -79,6 +340,95 @@ ADD_BP_METHOD_ARG(chunk, "file", Path, true,
                   "The file that you would like to chunk.")
 ADD_BP_METHOD_ARG(chunk, "chunkSize", Integer, false,
                   "The desired chunk size, not to exceed 2MB.  Default is 2MB.")
+ADD_BP_METHOD_ARG(chunk, "virtual", Boolean, false,
+                  "If true, no chunk files are created.  Instead an ordered list of "
+                  "objects with 'file', 'offset' and 'size' keys is returned, each "
+                  "describing a byte range of the original file which may be passed "
+                  "to read, readBase64, slice or getURL.  Default is false.")
+ADD_BP_METHOD_ARG(chunk, "callback", CallBack, false,
+                  "Invoked for each chunk as soon as it is ready, possibly out of "
+                  "order, so that chunks can be put to use while later ones are "
+                  "still being written.  The argument is an object with 'chunk' "
+                  "(an element of the eventual return value), 'chunkNumber' "
+                  "(zero based) and 'numberOfChunks' keys.")
+ADD_BP_METHOD_ARG(chunk, "digests", List, false,
+                  "Names of digests to compute for each chunk while it is written: "
+                  "any of 'md5', 'sha1', 'sha256' and 'crc32'.  When given, each "
+                  "element of the return value is an object with a 'digests' key "
+                  "mapping each name to its lowercase hex digest, and a 'file' key "
+                  "(plus 'offset' and 'size' for virtual chunks).")
+ADD_BP_METHOD_ARG(chunk, "contentDefined", Boolean, false,
+                  "If true, chunk boundaries are chosen by the file's content rather "
+                  "than at fixed offsets, so that regions of a file that haven't "
+                  "changed produce identical chunks even when data has been inserted "
+                  "or removed elsewhere.  chunkSize becomes the average chunk size.  "
+                  "Digests are always returned, sha256 unless 'digests' says "
+                  "otherwise.  Default is false.")
+ADD_BP_METHOD_ARG(chunk, "minSize", Integer, false,
+                  "Smallest content defined chunk, at least 64 bytes.  Default is a "
+                  "quarter of chunkSize.")
+ADD_BP_METHOD_ARG(chunk, "maxSize", Integer, false,
+                  "Largest content defined chunk, not to exceed 16MB.  Default is "
+                  "four times chunkSize.")
+ADD_BP_METHOD(FileAccess, hash,
+              "Compute digests of a file, or a byte range of it, in a single "
+              "pass.  Returns an object mapping each digest name to its "
+              "lowercase hex value.")
+ADD_BP_METHOD_ARG(hash, "file", Path, true,
+                  "The file to digest.")
+ADD_BP_METHOD_ARG(hash, "digests", List, false,
+                  "Names of the digests to compute: any of 'md5', 'sha1', 'sha256' "
+                  "and 'crc32'.  Default is sha256.")
+ADD_BP_METHOD_ARG(hash, "offset", Integer, false,
+                  "The beginning byte offset.")
+ADD_BP_METHOD_ARG(hash, "size", Integer, false,
+                  "The number of bytes to digest.  Default is through the end of "
+                  "the file.")
+ADD_BP_METHOD(FileAccess, readMany,
+              "Read several files, or byte ranges of them, in one call.  Returns "
+              "a list in the order of 'files', each element an object with a "
+              "'data' key holding what read (or readBase64) would return for the "
+              "entry, or an 'error' key if the entry failed.  Files are read in "
+              "parallel.  At most 16MB is returned in all, entries beyond that "
+              "fail.")
+ADD_BP_METHOD_ARG(readMany, "files", List, true,
+                  "Objects with a 'file' key and optional 'offset' and 'size' keys, "
+                  "as the arguments to read.  At most 1024 entries.")
+ADD_BP_METHOD_ARG(readMany, "base64", Boolean, false,
+                  "If true, data is base64 encoded as by readBase64.  Default is "
+                  "false.")
+ADD_BP_METHOD(FileAccess, chunkMany,
+              "Chunk several files in one call.  Returns a list in the order of "
+              "'files', each element an object with a 'chunks' key holding what "
+              "chunk would return for the entry, or an 'error' key if the entry "
+              "failed.  Files are chunked in parallel.")
+ADD_BP_METHOD_ARG(chunkMany, "files", List, true,
+                  "Objects with a 'file' key and an optional 'chunkSize' key, as the "
+                  "arguments to chunk.  At most 1024 entries.")
+ADD_BP_METHOD_ARG(chunkMany, "virtual", Boolean, false,
+                  "As for chunk, applies to every entry.  Default is false.")
+ADD_BP_METHOD_ARG(chunkMany, "digests", List, false,
+                  "As for chunk, applies to every entry.")
+ADD_BP_METHOD(FileAccess, revokeURL,
+              "Stop serving a url returned by getURL.  Returns true if the url "
+              "was valid.  The service keeps a bounded number of urls and "
+              "forgets the least recently used ones first, revoking urls "
+              "that are no longer needed keeps others alive.")
+ADD_BP_METHOD_ARG(revokeURL, "url", String, true,
+                  "The url to revoke.")
+ADD_BP_METHOD(FileAccess, release,
+              "Release files created by chunk or slice once they are no longer "
+              "needed, reclaiming their disk space.  Files that weren't created "
+              "by this service are ignored.  Returns the number of files released.  "
+              "Unreleased files are reclaimed automatically after an hour.")
+ADD_BP_METHOD_ARG(release, "files", List, true,
+                  "The files to release.")
+ADD_BP_METHOD(FileAccess, stats,
+              "Report what the service has been doing: for each method the "
+              "number of calls and their latency percentiles in microseconds, "
+              "the same for http requests along with bytes sent and counts by "
+              "status code, and temp storage use against its limits.  The same "
+              "object is served as JSON from /__stats on the getURL server.")
 END_BP_SERVICE_DESC
 
 FileAccess::FileAccess() : bplus::service::Service(),
@@ -86,6 +436,12 @@ FileAccess::FileAccess() : bplus::service::Service(),
 }
 
 FileAccess::~FileAccess() {
+    // what was traced is kept for a look after the fact
+    if (Trace::enabled(Trace::Requests)) {
+        boost::filesystem::path dump = boost::filesystem::path(dataDir()) / FA_TRACE_DUMP;
+        std::ofstream out(dump.string().c_str());
+        Trace::dump(out);
+    }
     assert(m_fs != NULL);
     if (m_fs != NULL) {
         delete m_fs;
@@ -103,36 +459,148 @@ FileAccess::finalConstruct() {
     boost::filesystem::path tempDir = boost::filesystem::path(tmpDir);
     m_fs = new FileServer(tempDir);
     assert(m_fs != NULL);
+    for (const char** m = s_timedMethods; *m; m++) {
+        m_fs->metrics().addMethod(*m);
+    }
+    configureServer(*m_fs, boost::filesystem::path(dataDir()) / FA_SERVER_CONFIG);
     m_fs->start();
 }
 
 void
 FileAccess::read(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "read");
     readImpl(tran, args, false);
 }
 
 void
 FileAccess::readBase64(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "readBase64");
     readImpl(tran, args, true);
 }
 
+void
+FileAccess::readStream(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "readStream");
+    const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
+    if (!bpPath) {
+        tran.error("bp.fileAccessError", "invalid file path");
+        return;
+    }
+    boost::filesystem::path path((bplus::tPathString)*bpPath);
+    long long offset = 0;
+    long long size = -1;
+    long long blockSize = FA_STREAM_BLOCK;
+    bool base64 = false;
+    if (args.has("offset", BPTInteger)) {
+        offset = (long long) *(args.get("offset"));
+    }
+    if (args.has("size", BPTInteger)) {
+        size = (long long) *(args.get("size"));
+    }
+    if (args.has("blockSize", BPTInteger)) {
+        blockSize = (long long) *(args.get("blockSize"));
+    }
+    if (args.has("base64", BPTBoolean)) {
+        base64 = (bool) *(args.get("base64"));
+    }
+    if (blockSize > FA_MAX_READ) {
+        blockSize = FA_MAX_READ;
+    }
+    if (base64) {
+        blockSize -= blockSize % 3;
+    }
+    // room for at least one character of text
+    if (blockSize < 4) {
+        tran.error("bp.fileAccessError", "block size is invalid");
+        return;
+    }
+
+    NativeFile file;
+    if (!file.openRead(path)) {
+        tran.error("bp.fileAccessError", "cannot open file for reading");
+        return;
+    }
+    long long fileSize = file.size();
+    if (fileSize < 0) {
+        tran.error("bp.fileAccessError", "read error");
+        return;
+    }
+    if (offset < 0 || offset > fileSize) {
+        tran.error("bp.fileAccessError", "offset out of range");
+        return;
+    }
+    long long end = fileSize;
+    if (size >= 0 && offset + size < fileSize) {
+        end = offset + size;
+    }
+
+    // the callback has no way to acknowledge a block, so pacing comes from
+    // reading a block only once the previous one has been handed over.  at
+    // most one block's worth of data is held at a time.
+    bplus::service::Callback cb(tran, *(args.get("callback")));
+    FileContents contents;
+    std::string err;
+    long long pos = offset;
+    while (pos < end) {
+        size_t want = (size_t) blockSize;
+        if ((long long) want > end - pos) {
+            want = (size_t) (end - pos);
+        }
+        if (!readRange(file, pos, want, base64, contents, err)) {
+            tran.error("bp.fileAccessError", err.c_str());
+            return;
+        }
+        size_t len = contents.length();
+        size_t covered = len;
+        if (!base64) {
+            if (len == 0) {
+                // file shrank under us
+                break;
+            }
+            // don't split a character across blocks, it starts the next one
+            if (pos + (long long) len < end) {
+                size_t tail = incompleteTail((const unsigned char*) contents.data(), len);
+                if (tail < len) {
+                    len -= tail;
+                    covered = len;
+                }
+            }
+        } else {
+            covered = want;
+            if (len == 0) {
+                break;
+            }
+        }
+        bplus::Map m;
+        m.add("data", new bplus::String(contents.data(), (unsigned int) len));
+        m.add("offset", new bplus::Integer(pos));
+        m.add("size", new bplus::Integer((long long) covered));
+        cb.invoke(m);
+        pos += (long long) covered;
+    }
+    tran.complete(bplus::Integer(pos - offset));
+}
+
 void
 FileAccess::slice(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "slice");
     // dig out args
     const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
     if (!bpPath) {
         tran.error("bp.fileAccessError", "invalid file path");
     }
     boost::filesystem::path path((bplus::tPathString)*bpPath);
-    log(BP_INFO, "slice");
-    size_t offset = 0, size = (size_t) -1;
+    long long offset = 0, size = -1;
     if (args.has("offset", BPTInteger)) {
-        offset = (int)(long long)*(args.get("offset"));            
+        offset = (long long) *(args.get("offset"));
     }
     if (args.has("size", BPTInteger)) {
-        size = (int)(long long)*(args.get("size"));            
+        size = (long long) *(args.get("size"));
+    }
+    if (offset < 0 || (args.has("size", BPTInteger) && size < 0)) {
+        tran.error("bp.fileAccessError", "offset or size out of range");
+        return;
     }
-    std::string err;
     try {
         boost::filesystem::path s = m_fs->getSlice(path, offset, size);
         tran.complete(bplus::Path(bp::file::nativeString(s)));
@@ -143,14 +611,32 @@ FileAccess::slice(const bplus::service::Transaction& tran, const bplus::Map& arg
 
 void
 FileAccess::getURL(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "getURL");
     // dig out args
     const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
     if (!bpPath) {
         tran.error("bp.fileAccessError", "invalid file path");
     }
     boost::filesystem::path path((bplus::tPathString)*bpPath);
-    log(BP_INFO, "getURL");
-    std::string url = m_fs->addFile(path);
+    long long offset = 0, size = -1;
+    if (args.has("offset", BPTInteger)) {
+        offset = (long long) *(args.get("offset"));
+    }
+    if (args.has("size", BPTInteger)) {
+        size = (long long) *(args.get("size"));
+    }
+    if (offset < 0) {
+        tran.error("bp.fileAccessError", "offset out of range");
+        return;
+    }
+    long idleTimeout = -1, lifetime = -1;
+    if (args.has("idleTimeout", BPTInteger)) {
+        idleTimeout = (long) (long long) *(args.get("idleTimeout"));
+    }
+    if (args.has("lifetime", BPTInteger)) {
+        lifetime = (long) (long long) *(args.get("lifetime"));
+    }
+    std::string url = m_fs->addFile(path, offset, size, idleTimeout, lifetime);
     if (url.empty()) {
         tran.error("bp.fileAccessError", NULL);
     } else {
@@ -158,142 +644,433 @@ FileAccess::getURL(const bplus::service::Transaction& tran, const bplus::Map& ar
     }
 }
 
+void
+FileAccess::revokeURL(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "revokeURL");
+    // dig out args
+    const bplus::String* url = dynamic_cast<const bplus::String*>(args.value("url"));
+    if (!url) {
+        tran.error("bp.fileAccessError", "invalid url");
+        return;
+    }
+    tran.complete(bplus::Bool(m_fs->removeFile(url->value())));
+}
+
+void
+FileAccess::release(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "release");
+    // dig out args
+    const bplus::List* files = dynamic_cast<const bplus::List*>(args.value("files"));
+    if (!files) {
+        tran.error("bp.fileAccessError", "invalid file list");
+        return;
+    }
+    long long released = 0;
+    for (unsigned int i = 0; i < files->size(); i++) {
+        const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(files->value(i));
+        if (bpPath && m_fs->releaseTempFile(boost::filesystem::path((bplus::tPathString)*bpPath))) {
+            released++;
+        }
+    }
+    tran.complete(bplus::Integer(released));
+}
+
+void
+FileAccess::stats(const bplus::service::Transaction& tran, const bplus::Map&) {
+    MethodTimer timer(m_fs, "stats");
+    MetricsSnapshot s;
+    m_fs->stats(s);
+    bplus::Map* m = new bplus::Map;
+    m->add("uptime", new bplus::Integer(s.m_uptime));
+    bplus::Map* methods = new bplus::Map;
+    std::map<std::string, LatencySummary>::const_iterator it;
+    for (it = s.m_methods.begin(); it != s.m_methods.end(); ++it) {
+        methods->add(it->first, latencyMap(it->second));
+    }
+    m->add("methods", methods);
+    bplus::Map* http = new bplus::Map;
+    http->add("requests", latencyMap(s.m_requests));
+    http->add("bytesSent", new bplus::Integer(s.m_bytesSent));
+    bplus::Map* codes = new bplus::Map;
+    std::map<int, long long>::const_iterator c;
+    for (c = s.m_statusCodes.begin(); c != s.m_statusCodes.end(); ++c) {
+        char code[16];
+        sprintf(code, "%d", c->first);
+        codes->add(code, new bplus::Integer(c->second));
+    }
+    http->add("statusCodes", codes);
+    m->add("http", http);
+    bplus::Map* temp = new bplus::Map;
+    temp->add("files", new bplus::Integer(s.m_tempFiles));
+    temp->add("bytes", new bplus::Integer(s.m_tempBytes));
+    temp->add("fileLimit", new bplus::Integer(s.m_tempFileLimit));
+    temp->add("byteLimit", new bplus::Integer(s.m_tempByteLimit));
+    m->add("tempStorage", temp);
+    m->add("urls", new bplus::Integer(s.m_urls));
+    m->add("openHandles", new bplus::Integer(s.m_openHandles));
+    tran.complete(*m);
+    delete m;
+}
+
 void
 FileAccess::chunk(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "chunk");
     // dig out args
     const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
     if (!bpPath) {
         tran.error("bp.fileAccessError", "invalid file path");
     }
     boost::filesystem::path path((bplus::tPathString)*bpPath);
-    log(BP_INFO, "chunk");
     size_t chunkSize = FA_CHUNK_SIZE;
     if (args.has("chunkSize", BPTInteger)) {
         chunkSize = (size_t)(long long)*(args.get("chunkSize"));            
     }
-    std::vector<ChunkInfo> v;
+    bool isVirtual = false;
+    if (args.has("virtual", BPTBoolean)) {
+        isVirtual = (bool) *(args.get("virtual"));
+    }
+    bool contentDefined = false;
+    if (args.has("contentDefined", BPTBoolean)) {
+        contentDefined = (bool) *(args.get("contentDefined"));
+    }
+    size_t minSize = chunkSize / 4, maxSize = chunkSize * 4;
+    if (args.has("minSize", BPTInteger)) {
+        minSize = (size_t)(long long)*(args.get("minSize"));
+    }
+    if (args.has("maxSize", BPTInteger)) {
+        maxSize = (size_t)(long long)*(args.get("maxSize"));
+    }
+    unsigned int digests = 0;
     std::string err;
+    if (!parseDigests(args, "digests", digests, err)) {
+        tran.error("bp.fileAccessError", err.c_str());
+        return;
+    }
+    if (contentDefined && !digests) {
+        // what getContentChunks computes when not told otherwise
+        digests = Digest::SHA256;
+    }
+    ChunkCallback* cb = NULL;
+    if (args.has("callback", BPTCallBack)) {
+        cb = new ChunkCallback(tran, *(args.get("callback")), isVirtual, digests != 0);
+    }
+    std::vector<ChunkInfo> v;
     try {
-        v = m_fs->getFileChunks(path, chunkSize);
+        if (contentDefined) {
+            v = m_fs->getContentChunks(path, minSize, chunkSize, maxSize, !isVirtual, cb, digests);
+        } else if (isVirtual) {
+            v = m_fs->getVirtualChunks(path, chunkSize, cb, digests);
+        } else {
+            v = m_fs->getFileChunks(path, chunkSize, cb, digests);
+        }
     } catch (const std::string& e) {
         err = e;
         v.clear();
     }
+    delete cb;
     if (v.empty()) {
         tran.error("bp.fileAccessError", err.c_str());
     } else {
         bplus::List* l = new bplus::List;
         for (size_t i = 0; i < v.size(); i++) {
-            l->append(new bplus::Path(bp::file::nativeString(v[i].m_path)));
+            l->append(chunkObject(v[i], isVirtual, digests != 0));
         }
         tran.complete(*l);
     }
 }
 
 void
-FileAccess::readImpl(const bplus::service::Transaction& tran, const bplus::Map& args, bool base64) {
-    // dig out args
+FileAccess::hash(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "hash");
     const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
     if (!bpPath) {
         tran.error("bp.fileAccessError", "invalid file path");
+        return;
     }
     boost::filesystem::path path((bplus::tPathString)*bpPath);
-    log(BP_INFO, base64 ? "readBase64" : "read");
-    unsigned int offset = 0;
-    int size = -1;
+    long long offset = 0, size = -1;
     if (args.has("offset", BPTInteger)) {
-        offset = (int) (long long) *(args.get("offset"));            
+        offset = (long long) *(args.get("offset"));
     }
     if (args.has("size", BPTInteger)) {
-        size = (int) (long long) *(args.get("size"));            
+        size = (long long) *(args.get("size"));
     }
-    bplus::String* contents = NULL;
+    unsigned int digests = 0;
     std::string err;
-    contents = readFileContents(path, offset, size, base64, err);
-    if (!err.empty() || contents == NULL) {
+    if (!parseDigests(args, "digests", digests, err)) {
         tran.error("bp.fileAccessError", err.c_str());
-    } else {
-        tran.complete(*contents);
+        return;
     }
-    if (contents) {
-        delete contents;
+    if (!digests) {
+        digests = Digest::SHA256;
+    }
+    try {
+        bplus::Map* m = digestMap(m_fs->getDigests(path, offset, size, digests));
+        tran.complete(*m);
+        delete m;
+    } catch (const std::string& e) {
+        tran.error("bp.fileAccessError", e.c_str());
     }
 }
 
-bool
-FileAccess::hasEmbeddedNulls(unsigned char * bytes, unsigned int len) {
-    for (unsigned int i = 0; i < len; i++) {
-        if (bytes[i] == 0) {
-            return true;
+// the list of entry maps args[key] of a batch call, false with err set
+// if it isn't one
+static bool
+batchEntries(const bplus::Map& args, const char* key,
+             std::vector<const bplus::Map*>& entries, std::string& err)
+{
+    const bplus::List* l = dynamic_cast<const bplus::List*>(args.value(key));
+    if (!l) {
+        err = "invalid file list";
+        return false;
+    }
+    if (l->size() > FA_MAX_BATCH) {
+        err = "too many files, greater than 1024 limit";
+        return false;
+    }
+    for (unsigned int i = 0; i < l->size(); i++) {
+        entries.push_back(dynamic_cast<const bplus::Map*>(l->value(i)));
+    }
+    return true;
+}
+
+// an entry's path, false if it hasn't got one
+static bool
+entryPath(const bplus::Map* entry, boost::filesystem::path& path)
+{
+    const bplus::Path* bpPath = entry ? dynamic_cast<const bplus::Path*>(entry->value("file")) : NULL;
+    if (!bpPath) {
+        return false;
+    }
+    path = boost::filesystem::path((bplus::tPathString)*bpPath);
+    return true;
+}
+
+// the result list of a batch call, key -> value for entries that
+// succeeded and "error" -> message for those that didn't.  takes values.
+static bplus::List*
+batchResults(const char* key, std::vector<bplus::Object*>& values,
+             const std::vector<std::string>& errors)
+{
+    bplus::List* l = new bplus::List;
+    for (size_t i = 0; i < values.size(); i++) {
+        bplus::Map* m = new bplus::Map;
+        if (values[i]) {
+            m->add(key, values[i]);
+        } else {
+            m->add("error", new bplus::String(errors[i]));
         }
+        l->append(m);
     }
-    return false;
+    return l;
 }
 
-bplus::String*
-FileAccess::readFileContents(const boost::filesystem::path& path, unsigned int offset, int size, bool base64, std::string& err) {
-    std::ifstream fstream;
-    // verify size is reasonable
-    if (size > FA_MAX_READ) {
-        err = "size too large, greater than 2mb limit";
-        return NULL;
-    }
-    // set to 2mb if 
-    if (size < 0) {
-        size = FA_MAX_READ;
-    }
-    // verify file exists and open
-    if (!bp::file::openReadableStream(fstream, path, std::ios_base::in | std::ios_base::binary)) {
-        err = "cannot open file for reading";
-        return NULL;
-    }
-    // now validate offset and size
-    fstream.seekg(0, std::ios::end);
-    if ((size_t)offset > fstream.tellg()) {
-        err = "offset out of range";        
-        return NULL;
-    }
-    // now set size to exact amount required
-    {
-        int avail = ((int)fstream.tellg() - (int)offset);
-        if (avail < size) {
-            size = avail;
+// reads the entries of a readMany, one per run()
+class BatchReader : public ParallelTask {
+public:
+    struct Entry {
+        boost::filesystem::path m_path;
+        long long m_offset;
+        long long m_size;
+        FileContents m_contents;
+        std::string m_err;
+    };
+    BatchReader(std::vector<Entry*>& entries, bool base64) :
+        m_entries(entries), m_base64(base64) {
+    }
+    virtual void run(size_t index) {
+        Entry& e = *m_entries[index];
+        if (e.m_err.empty()) {
+            readFileContents(e.m_path, e.m_offset, e.m_size, m_base64, e.m_contents, e.m_err);
         }
     }
-    fstream.seekg(offset, std::ios::beg);
-    // allocate memory:1
-    unsigned char* buffer = new unsigned char[size];
-    bplus::String* s = NULL;
-    if (base64) {
-        std::stringstream ss;
-        Base64 b64;
-        b64.encode(fstream, size, ss);
-        // encode into a js literal
-        s = new bplus::String(ss.str().c_str(), (unsigned int) ss.str().length());
-    } else {
-        // read data
-        fstream.read((char*)buffer, size);
-        if (fstream.gcount() > 0) {
-            // no support for "binary data" --> embedded nulls
-            if (hasEmbeddedNulls(buffer, (unsigned int)fstream.gcount())) {
-                delete [] buffer;
-                err = "binary data not supported";
-                return NULL;
+private:
+    std::vector<Entry*>& m_entries;
+    bool m_base64;
+};
+
+// chunks the entries of a chunkMany, one per run()
+class BatchChunker : public ParallelTask {
+public:
+    struct Entry {
+        boost::filesystem::path m_path;
+        size_t m_chunkSize;
+        std::vector<ChunkInfo> m_chunks;
+        std::string m_err;
+    };
+    BatchChunker(FileServer& fs, std::vector<Entry>& entries, bool isVirtual,
+                 unsigned int digests) :
+        m_fs(fs), m_entries(entries), m_virtual(isVirtual), m_digests(digests) {
+    }
+    virtual void run(size_t index) {
+        Entry& e = m_entries[index];
+        if (!e.m_err.empty()) {
+            return;
+        }
+        try {
+            if (m_virtual) {
+                e.m_chunks = m_fs.getVirtualChunks(e.m_path, e.m_chunkSize, NULL, m_digests);
+            } else {
+                e.m_chunks = m_fs.getFileChunks(e.m_path, e.m_chunkSize, NULL, m_digests);
             }
-            // encode into a js literal
-            s = new bplus::String((char*) buffer, (unsigned int)fstream.gcount());
-        } else {
-            s = new bplus::String("", 0);
+        } catch (const std::string& err) {
+            e.m_err = err;
+            e.m_chunks.clear();
+        }
+        if (e.m_chunks.empty() && e.m_err.empty()) {
+            e.m_err = "unable to chunk file";
         }
     }
-    fstream.close();
-    delete []buffer;
-    if (fstream.fail()) {
-        err = "read error";
-        if (s) {
-            delete s;
+private:
+    FileServer& m_fs;
+    std::vector<Entry>& m_entries;
+    bool m_virtual;
+    unsigned int m_digests;
+};
+
+void
+FileAccess::readMany(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "readMany");
+    std::vector<const bplus::Map*> entryArgs;
+    std::string err;
+    if (!batchEntries(args, "files", entryArgs, err)) {
+        tran.error("bp.fileAccessError", err.c_str());
+        return;
+    }
+    bool base64 = false;
+    if (args.has("base64", BPTBoolean)) {
+        base64 = (bool) *(args.get("base64"));
+    }
+    // settle what each entry reads up front (a stat, no open), so that the
+    // overall limit falls on the same entries however the reads interleave
+    std::vector<BatchReader::Entry*> entries;
+    long long budget = FA_MAX_BATCH_READ;
+    for (size_t i = 0; i < entryArgs.size(); i++) {
+        BatchReader::Entry* e = new BatchReader::Entry;
+        entries.push_back(e);
+        e->m_offset = 0;
+        e->m_size = -1;
+        if (!entryPath(entryArgs[i], e->m_path)) {
+            e->m_err = "invalid file path";
+            continue;
+        }
+        if (entryArgs[i]->has("offset", BPTInteger)) {
+            e->m_offset = (long long) *(entryArgs[i]->get("offset"));
+        }
+        if (entryArgs[i]->has("size", BPTInteger)) {
+            e->m_size = (long long) *(entryArgs[i]->get("size"));
+            if (e->m_size < 0) {
+                e->m_err = "offset or size out of range";
+                continue;
+            }
         }
-        s = NULL;
+        if (e->m_offset < 0) {
+            e->m_err = "offset or size out of range";
+            continue;
+        }
+        FileIdentity id;
+        long long want = (e->m_size < 0 || e->m_size > FA_MAX_READ) ? FA_MAX_READ : e->m_size;
+        if (pathIdentity(e->m_path, id) && id.m_size - e->m_offset < want) {
+            want = id.m_size - e->m_offset;
+        }
+        if (want > budget) {
+            e->m_err = "batch too large, greater than 16mb limit";
+        } else if (want > 0) {
+            budget -= want;
+        }
+    }
+    BatchReader reader(entries, base64);
+    runParallel(reader, entries.size(), FA_READ_BATCH_THREADS);
+    std::vector<bplus::Object*> values;
+    std::vector<std::string> errors;
+    for (size_t i = 0; i < entries.size(); i++) {
+        BatchReader::Entry* e = entries[i];
+        values.push_back(e->m_err.empty()
+                         ? new bplus::String(e->m_contents.data(), (unsigned int) e->m_contents.length())
+                         : NULL);
+        errors.push_back(e->m_err);
+        delete e;
+    }
+    bplus::List* l = batchResults("data", values, errors);
+    tran.complete(*l);
+    delete l;
+}
+
+void
+FileAccess::chunkMany(const bplus::service::Transaction& tran, const bplus::Map& args) {
+    MethodTimer timer(m_fs, "chunkMany");
+    std::vector<const bplus::Map*> entryArgs;
+    std::string err;
+    if (!batchEntries(args, "files", entryArgs, err)) {
+        tran.error("bp.fileAccessError", err.c_str());
+        return;
+    }
+    bool isVirtual = false;
+    if (args.has("virtual", BPTBoolean)) {
+        isVirtual = (bool) *(args.get("virtual"));
+    }
+    unsigned int digests = 0;
+    if (!parseDigests(args, "digests", digests, err)) {
+        tran.error("bp.fileAccessError", err.c_str());
+        return;
+    }
+    std::vector<BatchChunker::Entry> entries(entryArgs.size());
+    for (size_t i = 0; i < entryArgs.size(); i++) {
+        BatchChunker::Entry& e = entries[i];
+        e.m_chunkSize = FA_CHUNK_SIZE;
+        if (!entryPath(entryArgs[i], e.m_path)) {
+            e.m_err = "invalid file path";
+            continue;
+        }
+        if (entryArgs[i]->has("chunkSize", BPTInteger)) {
+            e.m_chunkSize = (size_t)(long long)*(entryArgs[i]->get("chunkSize"));
+        }
+    }
+    BatchChunker chunker(*m_fs, entries, isVirtual, digests);
+    runParallel(chunker, entries.size(), FA_CHUNK_BATCH_THREADS);
+    std::vector<bplus::Object*> values;
+    std::vector<std::string> errors;
+    for (size_t i = 0; i < entries.size(); i++) {
+        bplus::List* chunks = NULL;
+        if (entries[i].m_err.empty()) {
+            chunks = new bplus::List;
+            for (size_t j = 0; j < entries[i].m_chunks.size(); j++) {
+                chunks->append(chunkObject(entries[i].m_chunks[j], isVirtual, digests != 0));
+            }
+        }
+        values.push_back(chunks);
+        errors.push_back(entries[i].m_err);
+    }
+    bplus::List* l = batchResults("chunks", values, errors);
+    tran.complete(*l);
+    delete l;
+}
+
+void
+FileAccess::readImpl(const bplus::service::Transaction& tran, const bplus::Map& args, bool base64) {
+    // dig out args
+    const bplus::Path* bpPath = dynamic_cast<const bplus::Path*>(args.value("file"));
+    if (!bpPath) {
+        tran.error("bp.fileAccessError", "invalid file path");
+    }
+    boost::filesystem::path path((bplus::tPathString)*bpPath);
+    long long offset = 0, size = -1;
+    if (args.has("offset", BPTInteger)) {
+        offset = (long long) *(args.get("offset"));
+    }
+    if (args.has("size", BPTInteger)) {
+        size = (long long) *(args.get("size"));
+    }
+    if (offset < 0 || (args.has("size", BPTInteger) && size < 0)) {
+        tran.error("bp.fileAccessError", "offset or size out of range");
+        return;
+    }
+    FileContents contents;
+    std::string err;
+    if (!readFileContents(path, offset, size, base64, contents, err)) {
+        tran.error("bp.fileAccessError", err.c_str());
+    } else {
+        // the only copy of the data, into the result handed to the framework
+        tran.complete(bplus::String(contents.data(), (unsigned int)contents.length()));
     }
-    return s;
 }
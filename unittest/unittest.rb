@@ -5,7 +5,15 @@ require File.join(File.dirname(File.dirname(File.expand_path(__FILE__))),
 require 'uri'
 require 'test/unit'
 require 'open-uri'
+require 'net/http'
+require 'digest/md5'
+require 'digest/sha1'
+require 'digest/sha2'
+require 'zlib'
+require 'stringio'
 require 'rbconfig'
+require 'tmpdir'
+require 'socket'
 include Config
 
 class TestFileAccess < Test::Unit::TestCase
@@ -74,6 +82,287 @@ class TestFileAccess < Test::Unit::TestCase
     }
   end
 
+  # BrowserPlus.FileAccess.chunk({params}, function{}())
+  # Virtual chunks describe byte ranges of the original file instead of copies.
+  def test_chunk_virtual
+    BrowserPlus.run(@service, @providerDir) { |s|
+      Dir.glob(File.join(File.dirname(__FILE__), "cases_chunk", "*.json")).each do |f|
+        json = JSON.parse(File.read(f))
+        file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", json["file"])
+        file_uri = "path:" + file_path
+        content = File.open(file_path, "rb") { |f| f.read() }
+
+        chunksize = json["chunkSize"]
+        allchunks = s.chunk({ 'file' => file_uri, 'chunkSize' => chunksize, 'virtual' => true })
+        assert_equal((content.length + chunksize - 1) / chunksize, allchunks.length)
+        allchunks.each_with_index do |c, i|
+          assert_equal(File.basename(file_path), File.basename(c['file']))
+          assert_equal(i * chunksize, c['offset'])
+          want = content[i * chunksize, chunksize]
+          assert_equal(want.length, c['size'])
+          got = s.read({ 'file' => file_uri, 'offset' => c['offset'], 'size' => c['size'] })
+          assert_equal(want, got)
+          url = s.getURL({ 'file' => file_uri, 'offset' => c['offset'], 'size' => c['size'] })
+          got = open(url, "rb") { |f| f.read }
+          assert_equal(want, got)
+        end
+      end
+    }
+  end
+
+  # Views past 2GB, as chunk({ virtual: true }) hands out for large files,
+  # resolve through read, readBase64 and slice.
+  def test_chunk_virtual_large_offset
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(Dir.tmpdir, "FileAccess-large-#{$$}.txt")
+      begin
+        chunksize = 1024 * 1024
+        offset = 2**31 + chunksize
+        text = ("0123456789abcdef" * (chunksize / 16))
+        # sparse up to the text, which fills one chunk past 2GB
+        File.open(file_path, "wb") { |f|
+          f.seek(offset)
+          f.write(text)
+          f.write("\n" * chunksize)
+        }
+        file_uri = "path:" + file_path
+
+        allchunks = s.chunk({ 'file' => file_uri, 'chunkSize' => chunksize, 'virtual' => true })
+        c = allchunks.find { |c| c['offset'] == offset }
+        assert_not_nil(c)
+        assert_equal(chunksize, c['size'])
+
+        assert_equal(text, s.read({ 'file' => file_uri, 'offset' => c['offset'], 'size' => c['size'] }))
+        got = s.readBase64({ 'file' => file_uri, 'offset' => c['offset'], 'size' => 3000 })
+        assert_equal(text[0, 3000], got.unpack("m")[0])
+        got = s.slice({ 'file' => file_uri, 'offset' => c['offset'], 'size' => c['size'] })
+        assert_equal(text, open(got, "rb") { |f| f.read() })
+
+        assert_raise(RuntimeError) { s.slice({ 'file' => file_uri, 'offset' => -1 }) }
+        assert_raise(RuntimeError) { s.read({ 'file' => file_uri, 'size' => -1 }) }
+      ensure
+        File.delete(file_path) if File.exist?(file_path)
+      end
+    }
+  end
+
+  # BrowserPlus.FileAccess.readMany({params}, function{}())
+  # Read several files in one call, each entry succeeding or failing on its own.
+  def test_readmany
+    BrowserPlus.run(@service, @providerDir) { |s|
+      dir = File.join(File.dirname(File.expand_path(__FILE__)), "test_files")
+      text = File.open(File.join(dir, "services.txt"), "rb") { |f| f.read }
+      bin = File.open(File.join(dir, "service.bin"), "rb") { |f| f.read }
+      got = s.readMany({ 'files' => [
+                           { 'file' => "path:" + File.join(dir, "services.txt") },
+                           { 'file' => "path:" + File.join(dir, "services.txt"), 'offset' => 10, 'size' => 20 },
+                           { 'file' => "path:" + File.join(dir, "service.bin") },
+                           { 'file' => "path:" + File.join(dir, "nonexistent.txt") },
+                           { 'file' => "path:" + File.join(dir, "new.txt"), 'offset' => 100 } ] })
+      assert_equal(5, got.length)
+      assert_equal(text, got[0]['data'])
+      assert_equal(text[10, 20], got[1]['data'])
+      assert(got[2]['error'])
+      assert_nil(got[2]['data'])
+      assert_equal("cannot open file for reading", got[3]['error'])
+      assert_equal("offset out of range", got[4]['error'])
+
+      got = s.readMany({ 'files' => [ { 'file' => "path:" + File.join(dir, "service.bin") } ], 'base64' => true })
+      assert_equal([bin].pack("m0"), got[0]['data'])
+    }
+  end
+
+  # BrowserPlus.FileAccess.chunkMany({params}, function{}())
+  # Chunk several files in one call, matching what chunk gives for each.
+  def test_chunkmany
+    BrowserPlus.run(@service, @providerDir) { |s|
+      cases = Dir.glob(File.join(File.dirname(__FILE__), "cases_chunk", "*.json")).map { |f| JSON.parse(File.read(f)) }
+      dir = File.join(File.dirname(File.expand_path(__FILE__)), "test_files")
+      files = cases.map { |json| { 'file' => "path:" + File.join(dir, json["file"]), 'chunkSize' => json["chunkSize"] } }
+      files << { 'file' => "path:" + File.join(dir, "nonexistent.txt") }
+      got = s.chunkMany({ 'files' => files, 'virtual' => true, 'digests' => [ 'sha256' ] })
+      assert_equal(files.length, got.length)
+      cases.each_with_index do |json, i|
+        chunks = s.chunk({ 'file' => files[i]['file'], 'chunkSize' => json["chunkSize"], 'virtual' => true,
+                           'digests' => [ 'sha256' ] })
+        assert_equal(chunks, got[i]['chunks'])
+      end
+      assert(got.last['error'])
+    }
+  end
+
+  # BrowserPlus.FileAccess.release({params}, function{}())
+  # Release files created by chunk or slice.
+  def test_release
+    BrowserPlus.run(@service, @providerDir) { |s|
+      Dir.glob(File.join(File.dirname(__FILE__), "cases_chunk", "*.json")).each do |f|
+        json = JSON.parse(File.read(f))
+        file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", json["file"])
+        file_uri = "path:" + file_path
+
+        allchunks = s.chunk({ 'file' => file_uri, 'chunkSize' => json["chunkSize"] })
+        allchunks.each { |c| assert(File.exist?(c)) }
+        assert_equal(allchunks.length, s.release({ 'files' => allchunks.map { |c| "path:" + c } }))
+        allchunks.each { |c| assert(!File.exist?(c)) }
+
+        # files the service didn't create are left alone
+        assert_equal(0, s.release({ 'files' => [ file_uri ] }))
+        assert(File.exist?(file_path))
+      end
+    }
+  end
+
+  # Chunking an unchanged file again hands back the same chunk files, until they're released.
+  def test_chunk_cached
+    BrowserPlus.run(@service, @providerDir) { |s|
+      Dir.glob(File.join(File.dirname(__FILE__), "cases_chunk", "*.json")).each do |f|
+        json = JSON.parse(File.read(f))
+        file_uri = "path:" + File.join(File.dirname(File.expand_path(__FILE__)), "test_files", json["file"])
+
+        first = s.chunk({ 'file' => file_uri, 'chunkSize' => json["chunkSize"] })
+        assert_equal(first, s.chunk({ 'file' => file_uri, 'chunkSize' => json["chunkSize"] }))
+        next if first.length < 2
+
+        s.release({ 'files' => first.map { |c| "path:" + c } })
+        second = s.chunk({ 'file' => file_uri, 'chunkSize' => json["chunkSize"] })
+        assert_equal(first.length, second.length)
+        second.each { |c| assert(File.exist?(c)) }
+      end
+    }
+  end
+
+  def test_release_shared
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_uri = "path:" + File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+
+      # two callers handed the same cached chunks each own them
+      first = s.chunk({ 'file' => file_uri, 'chunkSize' => 1024 })
+      second = s.chunk({ 'file' => file_uri, 'chunkSize' => 1024 })
+      assert_equal(first, second)
+      assert_equal(first.length, s.release({ 'files' => first.map { |c| "path:" + c } }))
+      second.each { |c| assert(File.exist?(c)) }
+      assert_equal(second.length, s.release({ 'files' => second.map { |c| "path:" + c } }))
+      second.each { |c| assert(!File.exist?(c)) }
+    }
+  end
+
+  # Digests computed while chunking match those of the chunk files.
+  def test_chunk_digests
+    BrowserPlus.run(@service, @providerDir) { |s|
+      Dir.glob(File.join(File.dirname(__FILE__), "cases_chunk", "*.json")).each do |f|
+        json = JSON.parse(File.read(f))
+        file_uri = "path:" + File.join(File.dirname(File.expand_path(__FILE__)), "test_files", json["file"])
+
+        [ false, true ].each do |virt|
+          chunks = s.chunk({ 'file' => file_uri, 'chunkSize' => json["chunkSize"], 'virtual' => virt,
+                             'digests' => [ 'md5', 'sha1', 'crc32' ] })
+          chunks.each do |c|
+            data = File.open(c['file'], "rb") { |fh| fh.read }
+            data = data[c['offset'], c['size']] if virt
+            assert_equal(Digest::MD5.hexdigest(data), c['digests']['md5'])
+            assert_equal(Digest::SHA1.hexdigest(data), c['digests']['sha1'])
+            assert_equal("%08x" % Zlib.crc32(data), c['digests']['crc32'])
+          end
+        end
+      end
+    }
+  end
+
+  # Content defined chunks cover the file in order and come with sha256 digests.
+  def test_chunk_content_defined
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      want = File.open(file_path, "rb") { |fh| fh.read }
+      chunks = s.chunk({ 'file' => "path:" + file_path, 'chunkSize' => 1024, 'minSize' => 256,
+                         'maxSize' => 4096, 'contentDefined' => true, 'virtual' => true })
+      offset = 0
+      chunks.each do |c|
+        assert_equal(offset, c['offset'])
+        assert(c['size'] <= 4096)
+        assert_equal(Digest::SHA256.hexdigest(want[c['offset'], c['size']]), c['digests']['sha256'])
+        offset += c['size']
+      end
+      assert_equal(want.length, offset)
+
+      # the same boundaries when the chunks are written out
+      files = s.chunk({ 'file' => "path:" + file_path, 'chunkSize' => 1024, 'minSize' => 256,
+                        'maxSize' => 4096, 'contentDefined' => true })
+      assert_equal(chunks.map { |c| c['digests'] }, files.map { |c| c['digests'] })
+      assert_equal(want, files.map { |c| File.open(c['file'], "rb") { |fh| fh.read } }.join)
+
+      # the largest chunk is bounded, it sets the memory used to find them
+      assert_raise(RuntimeError) {
+        s.chunk({ 'file' => "path:" + file_path, 'chunkSize' => 1024, 'maxSize' => 16 * 1024 * 1024 + 1,
+                  'contentDefined' => true, 'virtual' => true })
+      }
+    }
+  end
+
+  # The callback sees every chunk once, each numbered as its place in the
+  # returned list, whether chunks are written, virtual or cached.
+  def test_chunk_callback
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_uri = "path:" + File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+
+      [ false, true, false ].each do |virt|
+        seen = []
+        chunks = s.chunk({ 'file' => file_uri, 'chunkSize' => 4096, 'virtual' => virt,
+                           'callback' => 1 }) { |cb| seen << cb }
+        assert(chunks.length > 1)
+        assert_equal(chunks.length, seen.length)
+        seen.each { |cb| assert_equal(chunks.length, cb['numberOfChunks']) }
+        # written chunks may be reported as they finish, out of order
+        inorder = seen.sort_by { |cb| cb['chunkNumber'] }
+        assert_equal((0...chunks.length).to_a, inorder.map { |cb| cb['chunkNumber'] })
+        assert_equal(chunks, inorder.map { |cb| cb['chunk'] })
+      end
+
+      # a cached result is reported in order
+      seen = []
+      chunks = s.chunk({ 'file' => file_uri, 'chunkSize' => 4096, 'callback' => 1 }) { |cb| seen << cb }
+      assert_equal((0...chunks.length).to_a, seen.map { |cb| cb['chunkNumber'] })
+      assert_equal(chunks, seen.map { |cb| cb['chunk'] })
+    }
+  end
+
+  # Object#hash shadows the service method of that name
+  def invoke_hash(s, args)
+    s.send(:method_missing, :hash, args)
+  end
+
+  # hash agrees with Ruby's digests, over whole files and byte ranges.
+  def test_hash
+    BrowserPlus.run(@service, @providerDir) { |s|
+      all = [ 'md5', 'sha1', 'sha256', 'crc32' ]
+      [ "services.txt", "service.bin", "new.txt" ].each do |name|
+        file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", name)
+        file_uri = "path:" + file_path
+        content = File.open(file_path, "rb") { |f| f.read }
+
+        [ [ {}, content ],
+          [ { 'offset' => 3 }, content[3..-1] ],
+          [ { 'offset' => 1, 'size' => 2 }, content[1, 2] ],
+          [ { 'offset' => content.length / 3, 'size' => content.length / 2 },
+            content[content.length / 3, content.length / 2] ],
+          [ { 'offset' => content.length }, "" ] ].each do |extra, data|
+          got = invoke_hash(s, { 'file' => file_uri, 'digests' => all }.merge(extra))
+          assert_equal(all.sort, got.keys.sort)
+          assert_equal(Digest::MD5.hexdigest(data), got['md5'])
+          assert_equal(Digest::SHA1.hexdigest(data), got['sha1'])
+          assert_equal(Digest::SHA256.hexdigest(data), got['sha256'])
+          assert_equal("%08x" % Zlib.crc32(data), got['crc32'])
+        end
+
+        # sha256 alone by default
+        got = invoke_hash(s, { 'file' => file_uri })
+        assert_equal({ 'sha256' => Digest::SHA256.hexdigest(content) }, got)
+
+        assert_raise(RuntimeError) { invoke_hash(s, { 'file' => file_uri, 'offset' => content.length + 1 }) }
+        assert_raise(RuntimeError) { invoke_hash(s, { 'file' => file_uri, 'digests' => [ 'md4' ] }) }
+      end
+    }
+  end
+
   # BrowserPlus.FileAccess.getURL({params}, function{}())
   # Get a localhost url that can be used to attain the full contents of a file on disk.
   def test_geturl
@@ -92,6 +381,308 @@ class TestFileAccess < Test::Unit::TestCase
     }
   end
 
+  # BrowserPlus.FileAccess.getURL({params}, function{}())
+  # Byte range requests against a getURL url return 206 Partial Content.
+  def test_geturl_range
+    BrowserPlus.run(@service, @providerDir) { |s|
+      Dir.glob(File.join(File.dirname(__FILE__), "cases_geturl", "*.json")).each do |f|
+        json = JSON.parse(File.read(f))
+        file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", json["file"] )
+        file_uri = "path:" + file_path
+        content = File.open(file_path, "rb") { |f| f.read }
+
+        uri = URI.parse(s.getURL({ 'file' => file_uri }))
+        Net::HTTP.start(uri.host, uri.port) { |http|
+          # explicit range
+          res = http.get(uri.path, { 'Range' => 'bytes=1-3' })
+          assert_equal("206", res.code)
+          assert_equal("bytes 1-3/#{content.length}", res['Content-Range'])
+          assert_equal(content[1, 3], res.body)
+
+          # suffix range
+          res = http.get(uri.path, { 'Range' => 'bytes=-2' })
+          assert_equal("206", res.code)
+          assert_equal(content[-2, 2], res.body)
+
+          # open ended range
+          res = http.get(uri.path, { 'Range' => 'bytes=2-' })
+          assert_equal("206", res.code)
+          assert_equal(content[2..-1], res.body)
+
+          # unsatisfiable range
+          res = http.get(uri.path, { 'Range' => "bytes=#{content.length}-" })
+          assert_equal("416", res.code)
+          assert_equal("bytes */#{content.length}", res['Content-Range'])
+
+          # no range
+          res = http.get(uri.path)
+          assert_equal("200", res.code)
+          assert_equal("bytes", res['Accept-Ranges'])
+          assert_equal(content, res.body)
+        }
+      end
+    }
+  end
+
+  # Responses carry validators, and a matching conditional request gets a 304.
+  def test_geturl_conditional
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      content = File.open(file_path, "rb") { |f| f.read }
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      Net::HTTP.start(uri.host, uri.port) { |http|
+        res = http.get(uri.path)
+        assert_equal("200", res.code)
+        etag = res['ETag']
+        modified = res['Last-Modified']
+        assert_not_nil(etag)
+        assert_not_nil(modified)
+        assert_not_nil(res['Cache-Control'])
+
+        res = http.get(uri.path, { 'If-None-Match' => etag })
+        assert_equal("304", res.code)
+        assert_equal(etag, res['ETag'])
+        assert(res.body.nil? || res.body.empty?)
+
+        res = http.get(uri.path, { 'If-Modified-Since' => modified })
+        assert_equal("304", res.code)
+
+        # a different etag wins over a matching date
+        res = http.get(uri.path, { 'If-None-Match' => '"nope"', 'If-Modified-Since' => modified })
+        assert_equal("200", res.code)
+        assert_equal(content, res.body)
+
+        # ranges only apply to the version the client has
+        res = http.get(uri.path, { 'Range' => 'bytes=0-1', 'If-Range' => etag })
+        assert_equal("206", res.code)
+        res = http.get(uri.path, { 'Range' => 'bytes=0-1', 'If-Range' => '"nope"' })
+        assert_equal("200", res.code)
+        assert_equal(content, res.body)
+      }
+    }
+  end
+
+  # Several requests, including errors, are answered over one connection.
+  def test_geturl_keepalive
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      content = File.open(file_path, "rb") { |f| f.read }
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      Net::HTTP.start(uri.host, uri.port) { |http|
+        res = http.get(uri.path)
+        assert_equal("1.1", res.http_version)
+        assert_equal("keep-alive", res['Connection'])
+        assert_equal(content, res.body)
+
+        res = http.get("/00000000-0000-0000-0000-000000000000")
+        assert_equal("404", res.code)
+        assert_equal("0", res['Content-Length'])
+        assert_equal("keep-alive", res['Connection'])
+
+        res = http.head(uri.path)
+        assert_equal(content.length.to_s, res['Content-Length'])
+
+        # still in step after the error and the bodiless HEAD
+        res = http.get(uri.path, { 'Range' => 'bytes=0-1' })
+        assert_equal(content[0, 2], res.body)
+
+        res = http.get(uri.path, { 'Connection' => 'close' })
+        assert_equal("close", res['Connection'])
+        assert_equal(content, res.body)
+      }
+    }
+  end
+
+  # The server closes a connection at its request limit (100 by default),
+  # whether or not the client heeds the Connection: close it's sent.
+  def test_geturl_keepalive_limit
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "new.txt")
+      content = File.open(file_path, "rb") { |f| f.read }
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      sock = TCPSocket.new(uri.host, uri.port)
+      begin
+        100.times do |i|
+          sock.write("GET #{uri.path} HTTP/1.1\r\nHost: #{uri.host}\r\n\r\n")
+          headers = ""
+          while (line = sock.gets) && line != "\r\n"
+            headers << line
+          end
+          assert_match(/^HTTP\/1.1 200/, headers)
+          assert_match(i < 99 ? /^Connection: keep-alive\r$/ : /^Connection: close\r$/, headers)
+          assert_equal(content, sock.read(headers[/^Content-Length: (\d+)/, 1].to_i))
+        end
+        # ignore the close and ask again: there's no answer, the server has
+        # closed its end
+        sock.write("GET #{uri.path} HTTP/1.1\r\nHost: #{uri.host}\r\n\r\n") rescue nil
+        assert_not_nil(IO.select([ sock ], nil, nil, 10), "connection left open")
+        assert_equal(nil, (sock.readpartial(1024) rescue nil))
+      ensure
+        sock.close
+      end
+    }
+  end
+
+  def test_geturl_method_not_allowed
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      Net::HTTP.start(uri.host, uri.port) { |http|
+        res = http.request(Net::HTTP::Delete.new(uri.path))
+        assert_equal("405", res.code)
+        assert_equal("GET, HEAD", res['Allow'])
+        assert_equal("close", res['Connection'])
+      }
+    }
+  end
+
+  def test_geturl_compressed
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      content = File.open(file_path, "rb") { |f| f.read }
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      Net::HTTP.start(uri.host, uri.port) { |http|
+        # compressed as it goes out the first time, from the cache after
+        2.times {
+          res = http.get(uri.path, { 'Accept-Encoding' => 'gzip' })
+          assert_equal("200", res.code)
+          assert_equal("gzip", res['Content-Encoding'])
+          assert_equal("Accept-Encoding", res['Vary'])
+          assert_equal(content, Zlib::GzipReader.new(StringIO.new(res.body)).read)
+        }
+
+        res = http.get(uri.path, { 'Accept-Encoding' => 'gzip;q=0, deflate' })
+        assert_equal("deflate", res['Content-Encoding'])
+        assert_equal(content, Zlib::Inflate.inflate(res.body))
+
+        # * doesn't bring back a coding refused by name
+        res = http.get(uri.path, { 'Accept-Encoding' => 'gzip;q=0, *' })
+        assert_equal("deflate", res['Content-Encoding'])
+        res = http.get(uri.path, { 'Accept-Encoding' => 'gzip;q=0, deflate;q=0, *' })
+        assert_equal(nil, res['Content-Encoding'])
+        assert_equal(content, res.body)
+
+        # the compressed variant has its own validator
+        etag = res['ETag']
+        res = http.get(uri.path, { 'Accept-Encoding' => 'deflate', 'If-None-Match' => etag })
+        assert_equal("304", res.code)
+        res = http.get(uri.path, { 'Accept-Encoding' => 'identity', 'If-None-Match' => etag })
+        assert_equal("200", res.code)
+        assert_equal(nil, res['Content-Encoding'])
+        assert_equal(content, res.body)
+
+        # ranges are always of the identity encoding
+        res = http.get(uri.path, { 'Accept-Encoding' => 'gzip', 'Range' => 'bytes=0-9' })
+        assert_equal("206", res.code)
+        assert_equal(nil, res['Content-Encoding'])
+        assert_equal(content[0, 10], res.body)
+      }
+    }
+  end
+
+  # A 1.0 client's compressed body ends when the connection does, even if
+  # it asked to keep the connection.
+  def test_geturl_compressed_http10
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(Dir.tmpdir, "FileAccess-http10-#{$$}.txt")
+      begin
+        # a new file, so there's no compressed copy of it yet
+        content = "compress me, compress me\n" * 1000
+        File.open(file_path, "wb") { |f| f.write(content) }
+        uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+        sock = TCPSocket.new(uri.host, uri.port)
+        begin
+          sock.write("GET #{uri.path} HTTP/1.0\r\nConnection: keep-alive\r\n" +
+                     "Accept-Encoding: gzip\r\n\r\n")
+          response = ""
+          loop do
+            assert_not_nil(IO.select([ sock ], nil, nil, 10), "connection left open")
+            data = sock.readpartial(65536) rescue nil
+            break if data.nil?
+            response << data
+          end
+          headers, body = response.split("\r\n\r\n", 2)
+          assert_match(/^Content-Encoding: gzip\r$/, headers + "\r")
+          assert_match(/^Connection: close\r$/, headers + "\r")
+          assert_equal(content, Zlib::GzipReader.new(StringIO.new(body)).read)
+        ensure
+          sock.close
+        end
+      ensure
+        File.delete(file_path) if File.exist?(file_path)
+      end
+    }
+  end
+
+  # BrowserPlus.FileAccess.revokeURL({params}, function{}())
+  # Stop serving a url returned by getURL.
+  def test_revokeurl
+    BrowserPlus.run(@service, @providerDir) { |s|
+      Dir.glob(File.join(File.dirname(__FILE__), "cases_geturl", "*.json")).each do |f|
+        json = JSON.parse(File.read(f))
+        file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", json["file"] )
+        file_uri = "path:" + file_path
+
+        url = s.getURL({ 'file' => file_uri })
+        open(url, "rb") { |f| f.read }
+        assert_equal(true, s.revokeURL({ 'url' => url }))
+        assert_raise(OpenURI::HTTPError) { open(url, "rb") { |f| f.read } }
+        assert_equal(false, s.revokeURL({ 'url' => url }))
+      end
+    }
+  end
+
+  # BrowserPlus.FileAccess.stats({params}, function{}())
+  # Counters for the service's methods and http server, also served at /__stats.
+  def test_stats
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      content = File.open(file_path, "rb") { |f| f.read }
+      s.read({ 'file' => "path:" + file_path })
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      Net::HTTP.start(uri.host, uri.port) { |http|
+        assert_equal(content, http.get(uri.path).body)
+        assert_equal("404", http.get("/00000000-0000-0000-0000-000000000000").code)
+
+        res = http.get("/__stats")
+        assert_equal("200", res.code)
+        assert_equal("application/json", res['Content-Type'])
+        stats = JSON.parse(res.body)
+        assert_equal(1, stats['methods']['read']['count'])
+        assert_equal(1, stats['methods']['getURL']['count'])
+        assert_equal(0, stats['methods']['chunk']['count'])
+        assert_equal(1, stats['http']['statusCodes']['200'])
+        assert_equal(1, stats['http']['statusCodes']['404'])
+        assert(stats['http']['bytesSent'] > 0)
+        assert_equal(1, stats['urls'])
+      }
+
+      stats = s.stats({})
+      assert_equal(2, stats['methods']['getURL']['count'] + stats['methods']['read']['count'])
+      # the /__stats request itself is counted by now
+      assert_equal(2, stats['http']['statusCodes']['200'])
+      assert_equal(3, stats['http']['requests']['count'])
+      assert(stats['http']['requests']['p50Micros'] <= stats['http']['requests']['maxMicros'])
+      assert_equal(1024, stats['tempStorage']['fileLimit'])
+      assert_equal(0, stats['tempStorage']['files'])
+    }
+  end
+
+  # The trace buffer isn't served: anyone on the machine could read the
+  # tokens of other pages' urls from it.
+  def test_trace_not_served
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      uri = URI.parse(s.getURL({ 'file' => "path:" + file_path }))
+      Net::HTTP.start(uri.host, uri.port) { |http|
+        http.get(uri.path)
+        res = http.get("/__trace")
+        assert_equal("404", res.code)
+        assert_equal("0", res['Content-Length'])
+      }
+    }
+  end
+
   # BrowserPlus.FileAccess.read({params}, function{}())
   # Read the contents of a file on disk returning a string. If the file contains binary data an error will be returned
   def test_read_text
@@ -109,6 +700,90 @@ class TestFileAccess < Test::Unit::TestCase
     }
   end
 
+  # BrowserPlus.FileAccess.readStream({params}, function{}())
+  # Hands over contiguous blocks of the requested range, in order, that put
+  # back together are the range.
+  def test_read_stream
+    BrowserPlus.run(@service, @providerDir) { |s|
+      text_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "services.txt")
+      text = File.open(text_path, "rb") { |f| f.read }
+
+      [ [ {}, 0, text.length ],
+        [ { 'offset' => 100, 'size' => 5000 }, 100, 5000 ],
+        [ { 'offset' => 30000 }, 30000, text.length - 30000 ],
+        [ { 'size' => 0 }, 0, 0 ] ].each do |extra, offset, size|
+        blocks = []
+        got = s.readStream({ 'file' => "path:" + text_path, 'blockSize' => 999,
+                             'callback' => 1 }.merge(extra)) { |cb| blocks << cb }
+        assert_equal(size, got)
+        assert_equal((size + 998) / 999, blocks.length)
+        pos = offset
+        blocks.each do |b|
+          assert_equal(pos, b['offset'])
+          assert(b['size'] <= 999)
+          assert_equal(text[b['offset'], b['size']], b['data'])
+          pos += b['size']
+        end
+        assert_equal(offset + size, pos)
+        assert_equal(text[offset, size], blocks.map { |b| b['data'] }.join)
+      end
+
+      # base64 blocks are a multiple of 3 bytes and decode to the file
+      bin_path = File.join(File.dirname(File.expand_path(__FILE__)), "test_files", "service.bin")
+      bin = File.open(bin_path, "rb") { |f| f.read }
+      blocks = []
+      got = s.readStream({ 'file' => "path:" + bin_path, 'blockSize' => 65536, 'base64' => true,
+                           'callback' => 1 }) { |cb| blocks << cb }
+      assert_equal(bin.length, got)
+      blocks[0...-1].each { |b| assert_equal(65535, b['size']) }
+      assert_equal(bin, blocks.map { |b| b['data'].unpack("m")[0] }.join)
+      assert_equal(bin, blocks.map { |b| b['data'] }.join.unpack("m")[0])
+
+      # a character is never split across blocks
+      file_path = File.join(Dir.tmpdir, "FileAccess-stream-#{$$}.txt")
+      begin
+        utf8 = "na\xc3\xafve caf\xc3\xa9 \xe2\x82\xac5\n" * 100
+        File.open(file_path, "wb") { |f| f.write(utf8) }
+        blocks = []
+        s.readStream({ 'file' => "path:" + file_path, 'blockSize' => 16,
+                       'callback' => 1 }) { |cb| blocks << cb }
+        blocks.each do |b|
+          assert_equal(utf8[b['offset'], b['size']], b['data'])
+          assert_nothing_raised { b['data'].unpack("U*") }
+        end
+        assert_equal(utf8, blocks.map { |b| b['data'] }.join)
+      ensure
+        File.delete(file_path) if File.exist?(file_path)
+      end
+
+      # bad arguments fail before anything is delivered
+      [ { 'file' => "path:" + text_path, 'offset' => text.length + 1 },
+        { 'file' => "path:" + text_path, 'blockSize' => 2 },
+        { 'file' => "path:" + text_path + ".missing" },
+        { 'file' => "path:" + bin_path } ].each do |args|
+        blocks = []
+        assert_raise(RuntimeError) { s.readStream(args.merge({ 'callback' => 1 })) { |cb| blocks << cb } }
+        assert_equal([], blocks)
+      end
+    }
+  end
+
+  # BrowserPlus.FileAccess.read({params}, function{}())
+  # Text needn't be UTF-8, only binary data (embedded NULs) is refused.
+  def test_read_latin1
+    BrowserPlus.run(@service, @providerDir) { |s|
+      file_path = File.join(Dir.tmpdir, "FileAccess-latin1-#{$$}.txt")
+      begin
+        File.open(file_path, "wb") { |f| f.write("caf\xe9 cr\xe8me br\xfbl\xe9e\n" * 10) }
+        assert_nothing_raised { s.read({ 'file' => "path:" + file_path }) }
+        File.open(file_path, "ab") { |f| f.write("\xe9\x00") }
+        assert_raise(RuntimeError) { s.read({ 'file' => "path:" + file_path }) }
+      ensure
+        File.delete(file_path) if File.exist?(file_path)
+      end
+    }
+  end
+
   # BrowserPlus.FileAccess.read({params}, function{}())
   # Read the contents of a file on disk returning a string. If the file contains binary data an error will be returned
   def test_read_binary